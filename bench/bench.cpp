@@ -0,0 +1,498 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+//Benchmark of the slicing pipeline. Every stage is timed on its own on a generated corpus of meshes, so changes to a single stage can be measured.
+// Run it with "make bench", or directly as "CuraEngineBench [-r repetitions] [-d corpusDirectory] [mesh names...]".
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <string>
+#include <vector>
+
+#include "../src/utils/gettime.h"
+#include "../src/utils/logoutput.h"
+#include "../src/sliceDataStorage.h"
+
+#include "../src/modelFile/modelFile.h"
+#include "../src/settings.h"
+#include "../src/optimizedModel.h"
+#include "../src/multiVolumes.h"
+#include "../src/polygonOptimizer.h"
+#include "../src/slicer.h"
+#include "../src/layerPart.h"
+#include "../src/inset.h"
+#include "../src/skin.h"
+#include "../src/infill.h"
+#include "../src/bridge.h"
+#include "../src/support.h"
+#include "../src/pathOrderOptimizer.h"
+#include "../src/skirt.h"
+#include "../src/raft.h"
+#include "../src/comb.h"
+#include "../src/gcodeExport.h"
+#include "../src/polygonHelper.h"
+#include "../src/modelInstances.h"
+#include "../src/extruderPlan.h"
+#include "../src/bandSlicer.h"
+#include "../src/fffProcessor.h"
+
+using namespace cura;
+
+/******************
+ * Corpus generation. All coordinates are in mm, faces are wound counter clockwise seen from the outside.
+ ******************/
+class BenchMesh
+{
+public:
+    vector<float> vertexes;
+
+    void addFace(double x0, double y0, double z0, double x1, double y1, double z1, double x2, double y2, double z2)
+    {
+        float v[9] = {float(x0), float(y0), float(z0), float(x1), float(y1), float(z1), float(x2), float(y2), float(z2)};
+        vertexes.insert(vertexes.end(), v, v + 9);
+    }
+
+    void addQuad(const double* p0, const double* p1, const double* p2, const double* p3)
+    {
+        addFace(p0[0], p0[1], p0[2], p1[0], p1[1], p1[2], p2[0], p2[1], p2[2]);
+        addFace(p0[0], p0[1], p0[2], p2[0], p2[1], p2[2], p3[0], p3[1], p3[2]);
+    }
+
+    void addBox(double x0, double y0, double z0, double x1, double y1, double z1)
+    {
+        double p[8][3] = {{x0,y0,z0}, {x1,y0,z0}, {x1,y1,z0}, {x0,y1,z0}, {x0,y0,z1}, {x1,y0,z1}, {x1,y1,z1}, {x0,y1,z1}};
+        addQuad(p[0], p[3], p[2], p[1]);//bottom
+        addQuad(p[4], p[5], p[6], p[7]);//top
+        addQuad(p[0], p[1], p[5], p[4]);//front
+        addQuad(p[2], p[3], p[7], p[6]);//back
+        addQuad(p[3], p[0], p[4], p[7]);//left
+        addQuad(p[1], p[2], p[6], p[5]);//right
+    }
+
+    void addCylinder(double cx, double cy, double radius, double height, int sides)
+    {
+        for(int n=0; n<sides; n++)
+        {
+            double a0 = 2.0 * M_PI * n / sides;
+            double a1 = 2.0 * M_PI * (n + 1) / sides;
+            double p0[3] = {cx + radius * cos(a0), cy + radius * sin(a0), 0};
+            double p1[3] = {cx + radius * cos(a1), cy + radius * sin(a1), 0};
+            double p2[3] = {p1[0], p1[1], height};
+            double p3[3] = {p0[0], p0[1], height};
+            addQuad(p0, p1, p2, p3);
+            addFace(cx, cy, 0, p1[0], p1[1], 0, p0[0], p0[1], 0);
+            addFace(cx, cy, height, p0[0], p0[1], height, p1[0], p1[1], height);
+        }
+    }
+
+    void addSphere(double cx, double cy, double cz, double radius, int slices, int stacks)
+    {
+        for(int j=0; j<stacks; j++)
+        {
+            double t0 = M_PI * j / stacks;
+            double t1 = M_PI * (j + 1) / stacks;
+            for(int i=0; i<slices; i++)
+            {
+                double f0 = 2.0 * M_PI * i / slices;
+                double f1 = 2.0 * M_PI * (i + 1) / slices;
+                double a[3] = {cx + radius * sin(t0) * cos(f0), cy + radius * sin(t0) * sin(f0), cz + radius * cos(t0)};
+                double b[3] = {cx + radius * sin(t1) * cos(f0), cy + radius * sin(t1) * sin(f0), cz + radius * cos(t1)};
+                double c[3] = {cx + radius * sin(t1) * cos(f1), cy + radius * sin(t1) * sin(f1), cz + radius * cos(t1)};
+                double d[3] = {cx + radius * sin(t0) * cos(f1), cy + radius * sin(t0) * sin(f1), cz + radius * cos(t0)};
+                //The triangles touching the poles collapse, leave those out.
+                if (j < stacks - 1)
+                    addFace(a[0], a[1], a[2], b[0], b[1], b[2], c[0], c[1], c[2]);
+                if (j > 0)
+                    addFace(a[0], a[1], a[2], c[0], c[1], c[2], d[0], d[1], d[2]);
+            }
+        }
+    }
+
+    bool saveBinarySTL(const char* filename)
+    {
+        FILE* f = fopen(filename, "wb");
+        if (!f)
+            return false;
+        char header[80];
+        memset(header, 0, sizeof(header));
+        strncpy(header, "CuraEngine benchmark corpus", sizeof(header) - 1);
+        fwrite(header, sizeof(header), 1, f);
+        uint32_t faceCount = vertexes.size() / 9;
+        fwrite(&faceCount, sizeof(faceCount), 1, f);
+        float normal[3] = {0, 0, 0};
+        uint16_t attribute = 0;
+        for(unsigned int n=0; n<faceCount; n++)
+        {
+            fwrite(normal, sizeof(normal), 1, f);
+            fwrite(&vertexes[n * 9], sizeof(float) * 9, 1, f);
+            fwrite(&attribute, sizeof(attribute), 1, f);
+        }
+        fclose(f);
+        return true;
+    }
+};
+
+static void generateSphere(BenchMesh& mesh, int slices, int stacks)
+{
+    mesh.addSphere(0, 0, 20, 20, slices, stacks);
+}
+
+//A cubic lattice of overlapping struts, which makes every layer a union of many touching outlines.
+static void generateLattice(BenchMesh& mesh)
+{
+    const int cells = 5;
+    const double cell = 8.0;
+    const double strut = 1.2;
+    for(int a=0; a<=cells; a++)
+    {
+        for(int b=0; b<=cells; b++)
+        {
+            double u = a * cell;
+            double v = b * cell;
+            double size = cells * cell + strut;
+            mesh.addBox(0, u, v, size, u + strut, v + strut);
+            mesh.addBox(u, 0, v, u + strut, size, v + strut);
+            mesh.addBox(u, v, 0, u + strut, v + strut, size);
+        }
+    }
+}
+
+//A plate full of small pins, giving hundreds of islands in every layer.
+static void generateIslands(BenchMesh& mesh)
+{
+    for(int x=0; x<20; x++)
+        for(int y=0; y<20; y++)
+            mesh.addCylinder(x * 5.0, y * 5.0, 1.5, 6.0, 12);
+}
+
+//A sphere with holes, duplicated and flipped faces, to exercise the stitching of open outlines.
+static void generateBroken(BenchMesh& mesh)
+{
+    BenchMesh sphere;
+    sphere.addSphere(0, 0, 20, 20, 128, 64);
+    unsigned int faceCount = sphere.vertexes.size() / 9;
+    for(unsigned int n=0; n<faceCount; n++)
+    {
+        const float* v = &sphere.vertexes[n * 9];
+        if (n % 41 == 0)
+            continue;
+        mesh.addFace(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8]);
+        if (n % 53 == 0)
+            mesh.addFace(v[0], v[1], v[2], v[6], v[7], v[8], v[3], v[4], v[5]);
+    }
+}
+
+class BenchCorpusEntry
+{
+public:
+    const char* name;
+    void (*generate)(BenchMesh& mesh);
+};
+
+static void generateSphereLow(BenchMesh& mesh) { generateSphere(mesh, 32, 16); }
+static void generateSphereMedium(BenchMesh& mesh) { generateSphere(mesh, 128, 64); }
+static void generateSphereHigh(BenchMesh& mesh) { generateSphere(mesh, 512, 256); }
+
+static const BenchCorpusEntry benchCorpus[] = {
+    {"sphere_32x16", generateSphereLow},
+    {"sphere_128x64", generateSphereMedium},
+    {"sphere_512x256", generateSphereHigh},
+    {"lattice", generateLattice},
+    {"islands", generateIslands},
+    {"broken", generateBroken},
+};
+
+/******************
+ * Stage timing
+ ******************/
+class BenchStage
+{
+public:
+    const char* name;
+    double bestTime;
+    double items;
+    const char* unit;
+};
+
+class BenchResult
+{
+public:
+    vector<BenchStage> stages;
+    int faceCount;
+    int layerCount;
+
+    BenchResult() : faceCount(0), layerCount(0) {}
+
+    //Keep the fastest of all repetitions for every stage.
+    void record(const char* name, double time, double items, const char* unit)
+    {
+        for(unsigned int n=0; n<stages.size(); n++)
+        {
+            if (strcmp(stages[n].name, name) == 0)
+            {
+                if (time < stages[n].bestTime)
+                    stages[n].bestTime = time;
+                return;
+            }
+        }
+        BenchStage stage = {name, time, items, unit};
+        stages.push_back(stage);
+    }
+};
+
+static bool runPipeline(const char* filename, ConfigSettings& config, BenchResult& result)
+{
+    TimeKeeper timeKeeper;
+    SimpleModel* model = new SimpleModel();
+    if (!loadModelFromFile(model, filename, config.matrix))
+    {
+        delete model;
+        return false;
+    }
+    int faceCount = 0;
+    for(unsigned int v=0; v<model->volumes.size(); v++)
+        faceCount += model->volumes[v].faces.size();
+    result.faceCount = faceCount;
+    result.record("load", timeKeeper.restart(), faceCount, "faces");
+
+    OptimizedModel* optimizedModel = new OptimizedModel(model, Point3(config.objectPosition.X, config.objectPosition.Y, -config.objectSink), config.autoCenter);
+    delete model;
+    result.record("optimize", timeKeeper.restart(), faceCount, "faces");
+
+    vector<LayerHeight> layerHeights;
+    calculateLayerHeights(optimizedModel, config.initialLayerThickness, config.layerThickness, config.adaptiveLayerCuspHeight, config.adaptiveLayerMinThickness, config.adaptiveLayerMaxThickness, layerHeights);
+    vector<Slicer*> slicerList;
+    for(unsigned int volumeIdx=0; volumeIdx < optimizedModel->volumes.size(); volumeIdx++)
+        slicerList.push_back(new Slicer(&optimizedModel->volumes[volumeIdx], layerHeights, config.fixHorrible & FIX_HORRIBLE_KEEP_NONE_CLOSED, config.fixHorrible & FIX_HORRIBLE_EXTENSIVE_STITCHING, config.outlineSimplifyTolerance));
+    unsigned int layerCount = slicerList.size() > 0 ? slicerList[0]->layers.size() : 0;
+    result.layerCount = layerCount;
+    result.record("slice", timeKeeper.restart(), layerCount, "layers");
+
+    SliceDataStorage storage;
+    storage.layerHeights = layerHeights;
+    generateSupportGrid(storage.support, optimizedModel, config.supportAngle, config.supportEverywhere > 0, config.supportXYDistance, config.supportZDistance);
+    delete optimizedModel;
+    result.record("support grid", timeKeeper.restart(), faceCount, "faces");
+
+    for(unsigned int volumeIdx=0; volumeIdx < slicerList.size(); volumeIdx++)
+    {
+        storage.volumes.push_back(SliceVolumeStorage());
+        createLayerParts(storage.volumes[volumeIdx], slicerList[volumeIdx], config.fixHorrible & (FIX_HORRIBLE_UNION_ALL_TYPE_A | FIX_HORRIBLE_UNION_ALL_TYPE_B | FIX_HORRIBLE_UNION_ALL_TYPE_C));
+        delete slicerList[volumeIdx];
+    }
+    result.record("layer parts", timeKeeper.restart(), layerCount, "layers");
+
+    for(unsigned int layerNr=0; layerNr<layerCount; layerNr++)
+        for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+            generateInsets(&storage.volumes[volumeIdx].layers[layerNr], config.extrusionWidth, config.insetCount, config.outlineSimplifyTolerance, layerNr > 0 ? &storage.volumes[volumeIdx].layers[layerNr - 1] : nullptr);
+    result.record("insets", timeKeeper.restart(), layerCount, "layers");
+
+    for(unsigned int layerNr=0; layerNr<layerCount; layerNr++)
+    {
+        for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+        {
+            generateSkins(layerNr, storage.volumes[volumeIdx], config.extrusionWidth, config.downSkinCount, config.upSkinCount, config.infillOverlap);
+            generateSparse(layerNr, storage.volumes[volumeIdx], config.extrusionWidth, config.downSkinCount, config.upSkinCount);
+        }
+    }
+    result.record("skins", timeKeeper.restart(), layerCount, "layers");
+
+    vector<Polygons> layerInfill(layerCount);
+    for(unsigned int layerNr=0; layerNr<layerCount; layerNr++)
+    {
+        for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+        {
+            SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
+            for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+            {
+                SliceLayerPart* part = &layer->parts[partNr];
+                generateLineInfill(part->skinOutline, layerInfill[layerNr], config.extrusionWidth, config.extrusionWidth, config.infillOverlap, (layerNr & 1) ? 45 : 135);
+                generateAutomaticInfill(part->sparseOutline, layerInfill[layerNr], config.extrusionWidth, config.sparseInfillLineDistance, config.infillOverlap, (layerNr & 1) ? 45 : 135);
+            }
+        }
+    }
+    result.record("infill", timeKeeper.restart(), layerCount, "layers");
+
+    if (storage.support.generated)
+    {
+        for(unsigned int layerNr=0; layerNr<layerCount; layerNr++)
+        {
+            SupportPolyGenerator supportGenerator(storage.support, storage.layerHeights[layerNr].printZ);
+        }
+        result.record("support", timeKeeper.restart(), layerCount, "layers");
+    }
+
+    for(unsigned int layerNr=0; layerNr<layerCount; layerNr++)
+    {
+        PathOrderOptimizer orderOptimizer(Point(0, 0));
+        for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+        {
+            SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
+            for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+                for(unsigned int insetNr=0; insetNr<layer->parts[partNr].insets.size(); insetNr++)
+                    orderOptimizer.addPolygons(layer->parts[partNr].insets[insetNr]);
+        }
+        orderOptimizer.optimize();
+    }
+    result.record("path order", timeKeeper.restart(), layerCount, "layers");
+
+    //Comb between the starts of all inset polygons of a part, like the travels between the walls do.
+    for(unsigned int layerNr=0; layerNr<layerCount; layerNr++)
+    {
+        for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+        {
+            SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
+            for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+            {
+                SliceLayerPart* part = &layer->parts[partNr];
+                if (part->combBoundery.size() < 1)
+                    continue;
+                Comb comb(part->combBoundery);
+                vector<Point> starts;
+                for(unsigned int insetNr=0; insetNr<part->insets.size(); insetNr++)
+                    for(unsigned int n=0; n<part->insets[insetNr].size(); n++)
+                        starts.push_back(part->insets[insetNr][n][0]);
+                vector<Point> combPoints;
+                for(unsigned int n=1; n<starts.size(); n++)
+                {
+                    combPoints.clear();
+                    comb.calc(starts[n-1], starts[n], combPoints);
+                }
+            }
+        }
+    }
+    result.record("combing", timeKeeper.restart(), layerCount, "layers");
+
+    {
+        GCodeExport gcode;
+        gcode.setFilename("/dev/null");
+        GCodePathConfig insetConfig(config.inset0Speed, config.extrusionWidth, "WALL-OUTER");
+        GCodePathConfig infillConfig(config.infillSpeed, config.extrusionWidth, "FILL");
+        for(unsigned int layerNr=0; layerNr<layerCount; layerNr++)
+        {
+            GCodePlanner gcodeLayer(gcode, config.moveSpeed, config.retractionMinimalDistance);
+            gcode.setExtrusion(storage.layerHeights[layerNr].thickness, config.filamentDiameter, config.filamentFlow);
+            gcode.setZ(storage.layerHeights[layerNr].printZ);
+            for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+            {
+                SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
+                for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+                {
+                    SliceLayerPart* part = &layer->parts[partNr];
+                    gcodeLayer.setCombBoundary(&part->combBoundery);
+                    for(int insetNr=part->insets.size()-1; insetNr>=0; insetNr--)
+                        gcodeLayer.addPolygonsByOptimizer(part->insets[insetNr], &insetConfig);
+                }
+            }
+            gcodeLayer.setCombBoundary(nullptr);
+            gcodeLayer.addPolygonsByOptimizer(layerInfill[layerNr], &infillConfig);
+            gcodeLayer.writeGCode(false, storage.layerHeights[layerNr].thickness);
+        }
+        gcode.flushPrintTimeEstimate();
+    }
+    result.record("gcode", timeKeeper.restart(), layerCount, "layers");
+
+    //The complete processor, as used by the command line, for an end to end number.
+    {
+        fffProcessor processor(config);
+        processor.setTargetFile("/dev/null");
+        std::vector<std::string> files;
+        files.push_back(filename);
+        processor.processFile(files);
+        processor.finalize();
+    }
+    result.record("total", timeKeeper.restart(), layerCount, "layers");
+    return true;
+}
+
+static void printResult(const char* name, BenchResult& result, double peakRSS)
+{
+    printf("%s: %d faces, %d layers, peak RSS %0.1f MB\n", name, result.faceCount, result.layerCount, peakRSS);
+    for(unsigned int n=0; n<result.stages.size(); n++)
+    {
+        BenchStage& stage = result.stages[n];
+        double throughput = stage.bestTime > 0.0 ? stage.items / stage.bestTime : 0.0;
+        printf("  %-14s %10.3f ms %14.0f %s/s\n", stage.name, stage.bestTime * 1000.0, throughput, stage.unit);
+    }
+    fflush(stdout);
+}
+
+static double getPeakRSS()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__) && defined(__MACH__)
+    return double(usage.ru_maxrss) / (1024.0 * 1024.0);
+#else
+    return double(usage.ru_maxrss) / 1024.0;
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    int repetitions = 3;
+    std::string corpusDirectory = "bench_corpus";
+    vector<std::string> selected;
+    for(int argn = 1; argn < argc; argn++)
+    {
+        if (strcmp(argv[argn], "-r") == 0 && argn + 1 < argc)
+            repetitions = std::max(1, atoi(argv[++argn]));
+        else if (strcmp(argv[argn], "-d") == 0 && argn + 1 < argc)
+            corpusDirectory = argv[++argn];
+        else
+            selected.push_back(argv[argn]);
+    }
+    mkdir(corpusDirectory.c_str(), 0755);
+
+    ConfigSettings config;
+    //Support is off by default, enable it so the support stages are measured too.
+    config.supportAngle = 60;
+
+    printf("CuraEngine benchmark, best of %d runs per stage\n", repetitions);
+    for(unsigned int n=0; n<sizeof(benchCorpus) / sizeof(benchCorpus[0]); n++)
+    {
+        const BenchCorpusEntry& entry = benchCorpus[n];
+        if (selected.size() > 0 && std::find(selected.begin(), selected.end(), std::string(entry.name)) == selected.end())
+            continue;
+        std::string filename = corpusDirectory + "/" + entry.name + ".stl";
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0)
+        {
+            BenchMesh mesh;
+            entry.generate(mesh);
+            if (!mesh.saveBinarySTL(filename.c_str()))
+            {
+                cLogError("Failed to write %s\n", filename.c_str());
+                return 1;
+            }
+        }
+
+        //Every mesh runs in its own process, so the peak RSS belongs to that mesh alone.
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            BenchResult result;
+            for(int r=0; r<repetitions; r++)
+            {
+                if (!runPipeline(filename.c_str(), config, result))
+                {
+                    cLogError("Failed to load %s\n", filename.c_str());
+                    _exit(1);
+                }
+            }
+            printResult(entry.name, result, getPeakRSS());
+            _exit(0);
+        }
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            cLogError("Benchmark of %s failed\n", entry.name);
+            return 1;
+        }
+    }
+    return 0;
+}
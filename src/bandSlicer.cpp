@@ -0,0 +1,203 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#include <stdlib.h>
+#include <string>
+#ifndef __WIN32
+#include <unistd.h>
+#endif
+
+#include "bandSlicer.h"
+#include "utils/logoutput.h"
+
+//Size of the write buffer of every spill file. Many bands are written at once, so this is kept small.
+#define FACE_SPILL_BUFFER_SIZE (64 * 1024)
+
+namespace cura {
+
+void VolumeBounds::addFace(Point3& v0, Point3& v1, Point3& v2)
+{
+    if (faceCount == 0)
+    {
+        min = v0;
+        max = v0;
+    }
+    faceCount++;
+    Point3* v[3] = {&v0, &v1, &v2};
+    for(unsigned int n=0; n<3; n++)
+    {
+        SET_MIN(min.x, v[n]->x);
+        SET_MIN(min.y, v[n]->y);
+        SET_MIN(min.z, v[n]->z);
+        SET_MAX(max.x, v[n]->x);
+        SET_MAX(max.y, v[n]->y);
+        SET_MAX(max.z, v[n]->z);
+    }
+}
+
+FaceSpill::FaceSpill()
+: faceCount(0), file(nullptr), buffer(nullptr)
+{
+#ifdef __WIN32
+    file = tmpfile();
+#else
+    //Spill to TMPDIR, so large spills can be moved off a small /tmp. The file is unlinked right away and removed when it is closed.
+    const char* dir = getenv("TMPDIR");
+    std::string path = std::string((dir && dir[0]) ? dir : "/tmp") + "/CuraEngineSpillXXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0)
+        return;
+    unlink(path.c_str());
+    file = fdopen(fd, "w+b");
+    if (file == nullptr)
+    {
+        close(fd);
+        return;
+    }
+#endif
+    if (file == nullptr)
+        return;
+    buffer = new char[FACE_SPILL_BUFFER_SIZE];
+    setvbuf(file, buffer, _IOFBF, FACE_SPILL_BUFFER_SIZE);
+}
+
+FaceSpill::~FaceSpill()
+{
+    if (file)
+        fclose(file);
+    delete[] buffer;
+}
+
+void FaceSpill::addFace(Point3& v0, Point3& v1, Point3& v2)
+{
+    int32_t data[9] = {v0.x, v0.y, v0.z, v1.x, v1.y, v1.z, v2.x, v2.y, v2.z};
+    if (file && fwrite(data, sizeof(data), 1, file) == 1)
+        faceCount++;
+}
+
+void FaceSpill::rewind()
+{
+    if (file)
+        fseek(file, 0, SEEK_SET);
+}
+
+bool FaceSpill::readFace(Point3& v0, Point3& v1, Point3& v2)
+{
+    int32_t data[9];
+    if (!file || fread(data, sizeof(data), 1, file) != 1)
+        return false;
+    v0 = Point3(data[0], data[1], data[2]);
+    v1 = Point3(data[3], data[4], data[5]);
+    v2 = Point3(data[6], data[7], data[8]);
+    return true;
+}
+
+BandSpill::BandSpill(int32_t zMin, int32_t bandHeight, int bandCount)
+: zMin(zMin), bandHeight(std::max(bandHeight, 1)), layerHeights(nullptr), zOffset(0)
+{
+    for(int n=0; n<bandCount; n++)
+        bands.push_back(new FaceSpill());
+}
+
+BandSpill::~BandSpill()
+{
+    for(unsigned int n=0; n<bands.size(); n++)
+        delete bands[n];
+}
+
+bool BandSpill::isOpen()
+{
+    for(unsigned int n=0; n<bands.size(); n++)
+        if (!bands[n]->isOpen())
+            return false;
+    return true;
+}
+
+int BandSpill::bandOf(int32_t z)
+{
+    int bandNr = (int64_t(z) - zMin) / bandHeight;
+    return std::max(0, std::min(bandNr, int(bands.size()) - 1));
+}
+
+void BandSpill::addFace(Point3& v0, Point3& v1, Point3& v2)
+{
+    int32_t minZ = std::min(v0.z, std::min(v1.z, v2.z));
+    int32_t maxZ = std::max(v0.z, std::max(v1.z, v2.z));
+    for(int bandNr = bandOf(minZ - BAND_MARGIN); bandNr <= bandOf(maxZ + BAND_MARGIN); bandNr++)
+        bands[bandNr]->addFace(v0, v1, v2);
+
+    //Faces that collapse when welded are not part of the optimized model, so they do not count for the layer heights either.
+    if (layerHeights && !(v0 - v1).testLength(MELD_DIST) && !(v1 - v2).testLength(MELD_DIST) && !(v2 - v0).testLength(MELD_DIST))
+    {
+        Point3 p0(v0.x, v0.y, v0.z - zOffset);
+        Point3 p1(v1.x, v1.y, v1.z - zOffset);
+        Point3 p2(v2.x, v2.y, v2.z - zOffset);
+        layerHeights->addFace(p0, p1, p2);
+    }
+}
+
+bool BandSpill::readBand(int bandNr, SimpleVolume& volume)
+{
+    FaceSpill* band = bands[bandNr];
+    if (!band)
+        return false;
+    volume.faces.reserve(band->faceCount);
+    band->rewind();
+    Point3 v0, v1, v2;
+    while(band->readFace(v0, v1, v2))
+        volume.addFace(v0, v1, v2);
+    bool complete = int64_t(volume.faces.size()) == band->faceCount;
+    delete band;
+    bands[bandNr] = nullptr;
+    return complete;
+}
+
+bool sliceVolumeBands(BandSpill& spill, Slicer& slicer, const vector<LayerHeight>& layerHeights, Point3 center, int autoCenter, Point3 modelMin, Point3 modelMax, FaceSpill* supportFaces, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance)
+{
+    int layerCount = layerHeights.size();
+    int firstLayerNr = 0;
+    for(int bandNr=0; bandNr<spill.bandCount(); bandNr++)
+    {
+        cLogProgress("slice", bandNr + 1, spill.bandCount());
+        SimpleModel band;
+        band.volumes.push_back(SimpleVolume());
+        if (!spill.readBand(bandNr, band.volumes[0]))
+        {
+            cLogError("Failed to read back band %i of the model\n", bandNr);
+            return false;
+        }
+        OptimizedModel optimizedBand(&band, center, autoCenter, modelMin, modelMax);
+        band.volumes.clear();
+        OptimizedVolume* ov = &optimizedBand.volumes[0];
+        //The optimized model is moved down by zOffset, the bands are in the coordinates of the model file.
+        int32_t zOffset = modelMin.z - optimizedBand.vMin.z;
+
+        int lastLayerNr = firstLayerNr;
+        int32_t bandTop = spill.zMin + int64_t(spill.bandHeight) * (bandNr + 1) - zOffset;
+        if (bandNr == spill.bandCount() - 1)
+            lastLayerNr = layerCount;
+        while(lastLayerNr < layerCount && layerHeights[lastLayerNr].sliceZ < bandTop)
+            lastLayerNr++;
+
+        if (lastLayerNr > firstLayerNr)
+        {
+            Slicer bandSlicer(ov, layerHeights, firstLayerNr, lastLayerNr, keepNoneClosed, extensiveStitching, simplifyTolerance);
+            for(int layerNr=firstLayerNr; layerNr<lastLayerNr; layerNr++)
+            {
+                slicer.layers[layerNr].polygonList = bandSlicer.layers[layerNr].polygonList;
+                slicer.layers[layerNr].openPolygons = bandSlicer.layers[layerNr].openPolygons;
+            }
+        }
+        firstLayerNr = lastLayerNr;
+
+        for(unsigned int i=0; supportFaces && i<ov->faces.size(); i++)
+        {
+            Point3& p0 = ov->points[ov->faces[i].index[0]].p;
+            Point3& p1 = ov->points[ov->faces[i].index[1]].p;
+            Point3& p2 = ov->points[ov->faces[i].index[2]].p;
+            if (spill.bandOf(std::min(p0.z, std::min(p1.z, p2.z)) + zOffset) == bandNr)
+                supportFaces->addFace(p0, p1, p2);
+        }
+    }
+    return true;
+}
+
+}//namespace cura
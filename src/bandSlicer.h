@@ -0,0 +1,87 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#ifndef BAND_SLICER_H
+#define BAND_SLICER_H
+
+#include <stdio.h>
+#include "modelFile/modelFile.h"
+#include "slicer.h"
+
+/*
+    Out of core slicing. A model that does not fit in memory is read from disk as a stream of faces, and spilled into temporary files
+    per band of Z. Every band is then welded and sliced on its own, so only the faces of a single band are in memory at any time.
+*/
+namespace cura {
+
+//Extra height around each band, so the points near the edge of a band are welded the same way as when the whole volume is welded at once.
+#define BAND_MARGIN (MELD_DIST * 4)
+//Most bands spilled at once, each band is an open temporary file.
+#define MAX_SPILL_BANDS 256
+
+//The bounds of a streamed volume, the same as SimpleVolume::min and SimpleVolume::max would give.
+class VolumeBounds : public FaceSink
+{
+public:
+    Point3 min, max;
+    int64_t faceCount;
+
+    VolumeBounds() : min(0, 0, 0), max(0, 0, 0), faceCount(0) {}
+
+    void addFace(Point3& v0, Point3& v1, Point3& v2);
+};
+
+//A temporary file of faces, written once and then read back from the start as often as needed. The file is removed when it is closed.
+class FaceSpill : public FaceSink
+{
+public:
+    int64_t faceCount;
+
+    FaceSpill();
+    ~FaceSpill();
+
+    bool isOpen() { return file != nullptr; }
+    void addFace(Point3& v0, Point3& v1, Point3& v2);
+    //Start reading at the first face, after all faces are added.
+    void rewind();
+    bool readFace(Point3& v0, Point3& v1, Point3& v2);
+
+private:
+    FILE* file;
+    char* buffer;
+
+    FaceSpill(const FaceSpill&);
+    FaceSpill& operator=(const FaceSpill&);
+};
+
+//Spreads the faces of a volume over a FaceSpill for every band of bandHeight, starting at zMin. A face is added to every band it crosses.
+class BandSpill : public FaceSink
+{
+public:
+    int32_t zMin, bandHeight;
+    //When set, every face is also given to the calculator, moved down by zOffset like the optimized model is.
+    LayerHeightCalculator* layerHeights;
+    int32_t zOffset;
+
+    BandSpill(int32_t zMin, int32_t bandHeight, int bandCount);
+    ~BandSpill();
+
+    bool isOpen();
+    int bandCount() { return bands.size(); }
+    int bandOf(int32_t z);
+    void addFace(Point3& v0, Point3& v1, Point3& v2);
+    //Read all the faces of a band into the volume, in the order they were added. The spill of the band is removed afterwards.
+    bool readBand(int bandNr, SimpleVolume& volume);
+
+private:
+    vector<FaceSpill*> bands;
+};
+
+/*
+    Slice a spilled volume band by band into the slicer. The faces of each band are welded with the bounds of the whole model, so they are placed
+    exactly like the in memory OptimizedModel would place them. Only the layers sliced inside a band are kept, the layers sliced in the margin
+    belong to the band next to it. The welded faces are added to supportFaces once, by the band that holds their lowest point.
+*/
+bool sliceVolumeBands(BandSpill& spill, Slicer& slicer, const vector<LayerHeight>& layerHeights, Point3 center, int autoCenter, Point3 modelMin, Point3 modelMax, FaceSpill* supportFaces, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance);
+
+}//namespace cura
+
+#endif//BAND_SLICER_H
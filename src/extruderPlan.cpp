@@ -0,0 +1,86 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#include <limits>
+#include "extruderPlan.h"
+#include "settings.h"
+
+namespace cura {
+
+static int extruderCount(unsigned int extruders)
+{
+    int count = 0;
+    for(; extruders; extruders &= extruders - 1)
+        count++;
+    return count;
+}
+
+int planExtruderOrder(int startExtruder, const std::vector<unsigned int>& layerExtruders, std::vector<std::vector<int> >& layerOrder)
+{
+    const int unreachable = std::numeric_limits<int>::max();
+    unsigned int layerCount = layerExtruders.size();
+
+    //switchCount[e] is the least amount of switches needed to end the current layer with extruder e.
+    //previous[layerNr][e] is the extruder the layer was entered with on that cheapest path.
+    std::vector<int> switchCount(MAX_EXTRUDERS, unreachable);
+    std::vector<std::vector<int> > previous(layerCount, std::vector<int>(MAX_EXTRUDERS, -1));
+    switchCount[startExtruder] = 0;
+    for(unsigned int layerNr=0; layerNr<layerCount; layerNr++)
+    {
+        unsigned int extruders = layerExtruders[layerNr];
+        int count = extruderCount(extruders);
+        std::vector<int> nextSwitchCount(MAX_EXTRUDERS, unreachable);
+        for(int enter=0; enter<MAX_EXTRUDERS; enter++)
+        {
+            if (switchCount[enter] == unreachable)
+                continue;
+            if (count == 0)
+            {
+                if (switchCount[enter] < nextSwitchCount[enter])
+                {
+                    nextSwitchCount[enter] = switchCount[enter];
+                    previous[layerNr][enter] = enter;
+                }
+                continue;
+            }
+            //The entering extruder prints first when it is used on this layer, so it can only be the last one when it is the only one.
+            bool enterUsed = extruders & (1 << enter);
+            int cost = switchCount[enter] + count - (enterUsed ? 1 : 0);
+            for(int exit=0; exit<MAX_EXTRUDERS; exit++)
+            {
+                if (!(extruders & (1 << exit)) || (exit == enter && count > 1))
+                    continue;
+                if (cost < nextSwitchCount[exit])
+                {
+                    nextSwitchCount[exit] = cost;
+                    previous[layerNr][exit] = enter;
+                }
+            }
+        }
+        switchCount.swap(nextSwitchCount);
+    }
+
+    int exit = startExtruder;
+    for(int e=0; e<MAX_EXTRUDERS; e++)
+        if (switchCount[e] < switchCount[exit])
+            exit = e;
+    int totalSwitchCount = switchCount[exit];
+
+    layerOrder.clear();
+    layerOrder.resize(layerCount);
+    for(int layerNr=int(layerCount)-1; layerNr>=0; layerNr--)
+    {
+        unsigned int extruders = layerExtruders[layerNr];
+        int enter = previous[layerNr][exit];
+        std::vector<int>& order = layerOrder[layerNr];
+        if (extruders & (1 << enter))
+            order.push_back(enter);
+        for(int e=0; e<MAX_EXTRUDERS; e++)
+            if ((extruders & (1 << e)) && e != enter && e != exit)
+                order.push_back(e);
+        if ((extruders & (1 << exit)) && exit != enter)
+            order.push_back(exit);
+        exit = enter;
+    }
+    return totalSwitchCount;
+}
+
+}//namespace cura
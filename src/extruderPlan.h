@@ -0,0 +1,20 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#ifndef EXTRUDER_PLAN_H
+#define EXTRUDER_PLAN_H
+
+#include <vector>
+
+namespace cura {
+
+/*
+ * Plan the order in which the extruders print each layer, so the whole print needs as few extruder switches as possible.
+ * layerExtruders holds, for every layer, a bitmask of the extruders that have something to print on that layer.
+ * Every layer starts with the extruder the previous layer ended with when that extruder is used on the layer,
+ * and ends with the extruder that leaves the cheapest path through all the layers above it.
+ * layerOrder receives the extruders of every layer in print order, each extruder once. Returns the total amount of switches.
+ */
+int planExtruderOrder(int startExtruder, const std::vector<unsigned int>& layerExtruders, std::vector<std::vector<int> >& layerOrder);
+
+}//namespace cura
+
+#endif//EXTRUDER_PLAN_H
@@ -2,47 +2,96 @@
 #define FFF_PROCESSOR_H
 
 #include <algorithm>
+#include <limits>
 #include <vector>
 #include "utils/socket.h"
 
 #define GUI_CMD_REQUEST_MESH 0x01
 #define GUI_CMD_SEND_POLYGONS 0x02
 #define GUI_CMD_FINISH_OBJECT 0x03
+#define GUI_CMD_SEND_POLYGONS_PACKED 0x04
+
+//Maximum amount of GUI data waiting to be sent before the engine waits for the GUI.
+#define GUI_SEND_QUEUE_SIZE (4 * 1024 * 1024)
 
 namespace cura {
 
+//Statistics of all the objects processed so far, complete after finalize.
+class PrintResult
+{
+public:
+    double printTime;
+    double filamentUsed[MAX_EXTRUDERS];
+    int layerCount;
+};
+
 //FusedFilamentFabrication processor.
 class fffProcessor
 {
 private:
     int maxObjectHeight;
     int fileNr;
+    int layerCount;
     GCodeExport gcode;
     ConfigSettings& config;
     TimeKeeper timeKeeper;
     ClientSocket guiSocket;
+    InfillCache ownInfillCache;
+    InfillCache& infillCache;
+    PathOrderCache pathOrderCache;
+    vector<ModelInstance> modelInstances;
+
+    //The infill and skin lines of a layer part, generated where the model is and moved to every instance of the model.
+    class PartPaths
+    {
+    public:
+        bool generated;
+        Polygons infill;
+        vector<Polygons> gradualInfill;
+        Polygons combinedInfill;
+        Polygons skin;
+
+        PartPaths() : generated(false) {}
+    };
 
     GCodePathConfig skirtConfig;
     GCodePathConfig inset0Config;
     GCodePathConfig insetXConfig;
     GCodePathConfig infillConfig;
+    GCodePathConfig combinedInfillConfig;
     GCodePathConfig skinConfig;
     GCodePathConfig supportConfig;
 public:
-    fffProcessor(ConfigSettings& config)
-    : config(config)
+    //A long running process can pass an infill cache that is kept between processors, so it stays warm between jobs.
+    fffProcessor(ConfigSettings& config, InfillCache* sharedInfillCache = nullptr)
+    : config(config), infillCache(sharedInfillCache ? *sharedInfillCache : ownInfillCache)
     {
         fileNr = 1;
         maxObjectHeight = 0;
+        layerCount = 0;
+    }
+
+    //Only plan the print for the time and filament estimate, without generating G-code.
+    void setEstimateOnly()
+    {
+        gcode.setEstimateOnly(true);
     }
 
     void guiConnect(int portNr)
     {
         guiSocket.connectTo("127.0.0.1", portNr);
+        guiSocket.enableAsyncSend(GUI_SEND_QUEUE_SIZE);
     }
 
     void sendPolygonsToGui(const char* name, int layerNr, int32_t z, Polygons& polygons)
     {
+        if (!guiSocket.isConnected())
+            return;
+        if (config.guiPackedPolygons)
+        {
+            sendPackedPolygonsToGui(name, layerNr, z, polygons);
+            return;
+        }
         guiSocket.sendNr(GUI_CMD_SEND_POLYGONS);
         guiSocket.sendNr(polygons.size());
         guiSocket.sendNr(layerNr);
@@ -65,6 +114,15 @@ public:
         return gcode.isOpened();
     }
 
+    //Write the G-code to an already opened file, the processor takes ownership of the file.
+    bool setTargetStream(FILE* file)
+    {
+        gcode.setFile(file);
+        if (gcode.isOpened())
+            gcode.writeComment("Generated with Cura_SteamEngine %s", VERSION);
+        return gcode.isOpened();
+    }
+
     bool processFile(const std::vector<std::string> &files)
     {
         if (!gcode.isOpened())
@@ -76,13 +134,27 @@ public:
         if (!prepareModel(storage, files))
             return false;
 
-        processSliceData(storage);
-        writeGCode(storage);
+        processAndWrite(storage, timeKeeperTotal);
+        return true;
+    }
 
-        cLogProgress("process", 1, 1);//Report the GUI that a file has been fully processed.
-        cLog("Total time elapsed %5.2fs.\n", timeKeeperTotal.restart());
-        guiSocket.sendNr(GUI_CMD_FINISH_OBJECT);
+    //Process a model that is already in memory, takes ownership of the model.
+    bool processModel(SimpleModel* model)
+    {
+        if (!gcode.isOpened())
+        {
+            delete model;
+            return false;
+        }
+
+        TimeKeeper timeKeeperTotal;
+        SliceDataStorage storage;
+        preSetup();
+        timeKeeper.restart();
+        if (!prepareModel(storage, model))
+            return false;
 
+        processAndWrite(storage, timeKeeperTotal);
         return true;
     }
 
@@ -93,7 +165,78 @@ public:
         gcode.finalize(maxObjectHeight, config.moveSpeed, config.endCode.c_str());
     }
 
+    PrintResult getPrintResult()
+    {
+        PrintResult result;
+        result.printTime = gcode.getTotalPrintTime();
+        for(unsigned int e=0; e<MAX_EXTRUDERS; e++)
+            result.filamentUsed[e] = gcode.getTotalFilamentUsed(e);
+        result.layerCount = layerCount;
+        return result;
+    }
+
 private:
+    static void appendInt(std::vector<char>& data, int32_t n)
+    {
+        const char* ptr = reinterpret_cast<const char*>(&n);
+        data.insert(data.end(), ptr, ptr + sizeof(int32_t));
+    }
+
+    static void appendVarint(std::vector<char>& data, uint64_t n)
+    {
+        while(n >= 0x80)
+        {
+            data.push_back(char((n & 0x7F) | 0x80));
+            n >>= 7;
+        }
+        data.push_back(char(n));
+    }
+
+    //Zigzag encoding maps small negative and positive numbers to small varints.
+    static void appendSignedVarint(std::vector<char>& data, int64_t n)
+    {
+        appendVarint(data, (uint64_t(n) << 1) ^ uint64_t(n >> 63));
+    }
+
+    //Same content as GUI_CMD_SEND_POLYGONS, but in a single frame: <command> <byteCount> <polygonCount> <layerNr> <z> <nameLength> <name>
+    // followed by every polygon as a varint point count and zigzag varint X/Y deltas to the previous point (the first point is relative to 0,0).
+    void sendPackedPolygonsToGui(const char* name, int layerNr, int32_t z, Polygons& polygons)
+    {
+        std::vector<char> data;
+        int nameLength = strlen(name);
+        appendInt(data, polygons.size());
+        appendInt(data, layerNr);
+        appendInt(data, z);
+        appendInt(data, nameLength);
+        data.insert(data.end(), name, name + nameLength);
+        for(unsigned int n=0; n<polygons.size(); n++)
+        {
+            PolygonRef polygon = polygons[n];
+            appendVarint(data, polygon.size());
+            Point previous(0, 0);
+            for(unsigned int i=0; i<polygon.size(); i++)
+            {
+                appendSignedVarint(data, polygon[i].X - previous.X);
+                appendSignedVarint(data, polygon[i].Y - previous.Y);
+                previous = polygon[i];
+            }
+        }
+        guiSocket.sendNr(GUI_CMD_SEND_POLYGONS_PACKED);
+        guiSocket.sendNr(data.size());
+        guiSocket.sendAll(data.data(), data.size());
+    }
+
+    void processAndWrite(SliceDataStorage& storage, TimeKeeper& timeKeeperTotal)
+    {
+        processSliceData(storage);
+        writeGCode(storage);
+
+        cLogProgress("process", 1, 1);//Report the GUI that a file has been fully processed.
+        cLog("Total time elapsed %5.2fs.\n", timeKeeperTotal.restart());
+        guiSocket.sendNr(GUI_CMD_FINISH_OBJECT);
+        guiSocket.flush();
+    }
+
     void preSetup()
     {
         skirtConfig.setData(config.printSpeed, config.extrusionWidth, "SKIRT");
@@ -107,12 +250,22 @@ private:
             gcode.setExtruderOffset(n, config.extruderOffset[n].p());
         gcode.setSwitchExtruderCode(config.preSwitchExtruderCode, config.postSwitchExtruderCode);
         gcode.setFlavor(config.gcodeFlavor);
+        gcode.setArcFittingTolerance(config.arcFittingTolerance);
         gcode.setRetractionSettings(config.retractionAmount, config.retractionSpeed, config.retractionAmountExtruderSwitch, config.minimalExtrusionBeforeRetraction, config.retractionZHop, config.retractionAmountPrime);
         gcode.applyAccelerationSettings(config);
+
+        if (!parseModelInstances(config.modelInstances.c_str(), modelInstances))
+        {
+            cLogError("Invalid model instances: %s\n", config.modelInstances.c_str());
+            modelInstances.clear();
+        }
     }
 
     bool prepareModel(SliceDataStorage& storage, const std::vector<std::string> &files)
     {
+        if (config.outOfCoreBandHeight > 0 && !(files.size() == 1 && files[0][0] == '$'))
+            return prepareModelOutOfCore(storage, files);
+
         timeKeeper.restart();
         SimpleModel* model = nullptr;
         if (files.size() == 1 && files[0][0] == '$')
@@ -126,21 +279,15 @@ private:
                 guiSocket.sendNr(GUI_CMD_REQUEST_MESH);
 
                 int32_t vertexCount = guiSocket.recvNr();
-                int pNr = 0;
                 cLog("Reading mesh from socket with %i vertexes\n", vertexCount);
-                Point3 v[3];
-                while(vertexCount)
+                std::vector<float> vertexes;
+                while(vertexCount > 0 && guiSocket.isConnected())
                 {
-                    float f[3];
-                    guiSocket.recvAll(f, 3 * sizeof(float));
-                    FPoint3 fp(f[0], f[1], f[2]);
-                    v[pNr++] = config.matrix.apply(fp);
-                    if (pNr == 3)
-                    {
-                        volume->addFace(v[0], v[1], v[2]);
-                        pNr = 0;
-                    }
-                    vertexCount--;
+                    int batch = std::min(vertexCount, MESH_VERTEX_BATCH_SIZE);
+                    vertexes.resize(batch * 3);
+                    guiSocket.recvAll(vertexes.data(), batch * 3 * sizeof(float));
+                    addFacesFromVertexes(volume, vertexes.data(), batch, config.matrix);
+                    vertexCount -= batch;
                 }
             }
         }else{
@@ -159,8 +306,14 @@ private:
             }
         }
         cLog("Loaded from disk in %5.3fs\n", timeKeeper.restart());
+        return prepareModel(storage, model);
+    }
+
+    //Slice the given model into the storage, takes ownership of the model.
+    bool prepareModel(SliceDataStorage& storage, SimpleModel* model)
+    {
         cLog("Analyzing and optimizing model...\n");
-        OptimizedModel* optimizedModel = new OptimizedModel(model, Point3(config.objectPosition.X, config.objectPosition.Y, -config.objectSink));
+        OptimizedModel* optimizedModel = new OptimizedModel(model, Point3(config.objectPosition.X, config.objectPosition.Y, -config.objectSink), config.autoCenter);
         for(unsigned int v = 0; v < model->volumes.size(); v++)
         {
             cLog("  Face counts: %i -> %i %0.1f%%\n", (int)model->volumes[v].faces.size(), (int)optimizedModel->volumes[v].faces.size(), float(optimizedModel->volumes[v].faces.size()) / float(model->volumes[v].faces.size()) * 100);
@@ -184,10 +337,11 @@ private:
         //om->saveDebugSTL("c:\\models\\output.stl");
 
         cLog("Slicing model...\n");
+        calculateLayerHeights(optimizedModel, config.initialLayerThickness, config.layerThickness, config.adaptiveLayerCuspHeight, config.adaptiveLayerMinThickness, config.adaptiveLayerMaxThickness, storage.layerHeights);
         vector<Slicer*> slicerList;
         for(unsigned int volumeIdx=0; volumeIdx < optimizedModel->volumes.size(); volumeIdx++)
         {
-            Slicer* slicer = new Slicer(&optimizedModel->volumes[volumeIdx], config.initialLayerThickness - config.layerThickness / 2, config.layerThickness, config.fixHorrible & FIX_HORRIBLE_KEEP_NONE_CLOSED, config.fixHorrible & FIX_HORRIBLE_EXTENSIVE_STITCHING);
+            Slicer* slicer = new Slicer(&optimizedModel->volumes[volumeIdx], storage.layerHeights, config.fixHorrible & FIX_HORRIBLE_KEEP_NONE_CLOSED, config.fixHorrible & FIX_HORRIBLE_EXTENSIVE_STITCHING, config.outlineSimplifyTolerance);
             slicerList.push_back(slicer);
             for(unsigned int layerNr=0; layerNr<slicer->layers.size(); layerNr++)
             {
@@ -198,14 +352,229 @@ private:
         }
         cLog("Sliced model in %5.3fs\n", timeKeeper.restart());
 
-        cLog("Generating support map...\n");
-        generateSupportGrid(storage.support, optimizedModel, config.supportAngle, config.supportEverywhere > 0, config.supportXYDistance, config.supportZDistance);
+        arrangeModel(slicerList);
 
+        //The bounds of a single copy, setModelInstances grows them to all instances after the layer parts are processed.
         storage.modelSize = optimizedModel->modelSize;
         storage.modelMin = optimizedModel->vMin;
         storage.modelMax = optimizedModel->vMax;
+
+        cLog("Generating support map...\n");
+        //The slicers are done with the model, so it can be replaced by all instances for the support.
+        if (config.supportAngle > -1)
+            addModelInstances(optimizedModel, modelInstances, config.objectPosition.p());
+        generateSupportGrid(storage.support, optimizedModel, config.supportAngle, config.supportEverywhere > 0, config.supportXYDistance, config.supportZDistance);
         delete optimizedModel;
 
+        createVolumeLayerParts(storage, slicerList);
+        return true;
+    }
+
+    //Slice the model files band by band, with only a single band of the model in memory at a time. See bandSlicer.h.
+    bool prepareModelOutOfCore(SliceDataStorage& storage, const std::vector<std::string> &files)
+    {
+        timeKeeper.restart();
+        //The whole model is placed by its bounds, so those are read first.
+        vector<VolumeBounds> volumeBounds(files.size());
+        for(unsigned int i=0; i<files.size(); i++)
+        {
+            if (files[i] == "-")
+                continue;
+            cLog("Reading bounds of %s from disk...\n", files[i].c_str());
+            if (!streamModelFromFile(files[i].c_str(), config.matrix, volumeBounds[i]))
+            {
+                cLogError("Failed to load model: %s\n", files[i].c_str());
+                return false;
+            }
+        }
+        Point3 modelMin = volumeBounds[0].min;
+        Point3 modelMax = volumeBounds[0].max;
+        for(unsigned int i=0; i<volumeBounds.size(); i++)
+        {
+            SET_MIN(modelMin.x, volumeBounds[i].min.x);
+            SET_MIN(modelMin.y, volumeBounds[i].min.y);
+            SET_MIN(modelMin.z, volumeBounds[i].min.z);
+            SET_MAX(modelMax.x, volumeBounds[i].max.x);
+            SET_MAX(modelMax.y, volumeBounds[i].max.y);
+            SET_MAX(modelMax.z, volumeBounds[i].max.z);
+        }
+        Point3 center(config.objectPosition.X, config.objectPosition.Y, -config.objectSink);
+        SimpleModel emptyModel;
+        OptimizedModel placement(&emptyModel, center, config.autoCenter, modelMin, modelMax);
+        cLog("  Size: %f %f %f\n", INT2MM(placement.modelSize.x), INT2MM(placement.modelSize.y), INT2MM(placement.modelSize.z));
+        if (INT2MM(placement.modelSize.x) > 10000.0 || INT2MM(placement.modelSize.y)  > 10000.0 || INT2MM(placement.modelSize.z) > 10000.0)
+        {
+            cLogError("Object is way to big, CuraEngine bug?");
+            exit(1);
+        }
+        cLog("Read bounds in %5.3fs\n", timeKeeper.restart());
+
+        //Spill every volume into its bands, which also collects the slopes for the adaptive layer heights.
+        int bandLimit = std::max(MAX_SPILL_BANDS / int(files.size()), 1);
+        int32_t bandHeight = std::max(config.outOfCoreBandHeight, int(placement.modelSize.z / bandLimit + 1));
+        int bandCount = placement.modelSize.z / bandHeight + 1;
+        LayerHeightCalculator layerHeightCalculator(placement.modelSize.z, config.initialLayerThickness, config.layerThickness, config.adaptiveLayerCuspHeight, config.adaptiveLayerMinThickness, config.adaptiveLayerMaxThickness);
+        vector<BandSpill*> spills;
+        bool spilled = true;
+        for(unsigned int i=0; i<files.size() && spilled; i++)
+        {
+            spills.push_back(new BandSpill(modelMin.z, bandHeight, bandCount));
+            spills[i]->layerHeights = &layerHeightCalculator;
+            spills[i]->zOffset = modelMin.z - placement.vMin.z;
+            if (!spills[i]->isOpen())
+            {
+                cLogError("Failed to create the temporary files to slice %s\n", files[i].c_str());
+                spilled = false;
+            }else if (files[i] != "-")
+            {
+                cLog("Spilling %s into %i bands of %0.1fmm...\n", files[i].c_str(), bandCount, INT2MM(bandHeight));
+                spilled = streamModelFromFile(files[i].c_str(), config.matrix, *spills[i]);
+            }
+        }
+        if (spilled)
+            cLog("Spilled model in %5.3fs\n", timeKeeper.restart());
+
+        cLog("Slicing model...\n");
+        layerHeightCalculator.calculate(storage.layerHeights);
+        FaceSpill* supportFaces = nullptr;
+        if (config.supportAngle > -1)
+            supportFaces = new FaceSpill();
+        vector<Slicer*> slicerList;
+        for(unsigned int volumeIdx=0; volumeIdx < spills.size(); volumeIdx++)
+        {
+            Slicer* slicer = new Slicer(storage.layerHeights, placement.modelSize, placement.vMin);
+            slicerList.push_back(slicer);
+            if (spilled)
+                spilled = sliceVolumeBands(*spills[volumeIdx], *slicer, storage.layerHeights, center, config.autoCenter, modelMin, modelMax, supportFaces, config.fixHorrible & FIX_HORRIBLE_KEEP_NONE_CLOSED, config.fixHorrible & FIX_HORRIBLE_EXTENSIVE_STITCHING, config.outlineSimplifyTolerance);
+            delete spills[volumeIdx];
+            for(unsigned int layerNr=0; layerNr<slicer->layers.size(); layerNr++)
+                sendPolygonsToGui("openoutline", layerNr, slicer->layers[layerNr].z, slicer->layers[layerNr].openPolygons);
+        }
+        if (!spilled)
+        {
+            for(unsigned int volumeIdx=0; volumeIdx < slicerList.size(); volumeIdx++)
+                delete slicerList[volumeIdx];
+            delete supportFaces;
+            return false;
+        }
+        cLog("Sliced model in %5.3fs\n", timeKeeper.restart());
+
+        arrangeModel(slicerList);
+
+        cLog("Generating support map...\n");
+        generateSupportGridFromSpill(storage, supportFaces, placement);
+        delete supportFaces;
+
+        storage.modelSize = placement.modelSize;
+        storage.modelMin = placement.vMin;
+        storage.modelMax = placement.vMax;
+
+        createVolumeLayerParts(storage, slicerList);
+        return true;
+    }
+
+    //The support grid of the spilled faces of the model, for every instance like addModelInstances does for the in memory model.
+    void generateSupportGridFromSpill(SliceDataStorage& storage, FaceSpill* supportFaces, OptimizedModel& placement)
+    {
+        storage.support.generated = false;
+        if (supportFaces == nullptr)
+            return;
+
+        vector<PointMatrix> instanceMatrix;
+        for(unsigned int i=0; i<modelInstances.size(); i++)
+            instanceMatrix.push_back(PointMatrix(modelInstances[i].rotation));
+        Point center = config.objectPosition.p();
+
+        Point3 gridMin = placement.vMin;
+        Point3 gridMax = placement.vMax;
+        Point3 v[3];
+        if (modelInstances.size() > 0)
+        {
+            gridMin.x = gridMin.y = std::numeric_limits<int32_t>::max();
+            gridMax.x = gridMax.y = std::numeric_limits<int32_t>::min();
+            supportFaces->rewind();
+            while(supportFaces->readFace(v[0], v[1], v[2]))
+            {
+                for(unsigned int i=0; i<modelInstances.size(); i++)
+                {
+                    for(unsigned int n=0; n<3; n++)
+                    {
+                        Point p = transformPoint(Point(v[n].x, v[n].y), instanceMatrix[i], modelInstances[i], center);
+                        SET_MIN(gridMin.x, p.X);
+                        SET_MIN(gridMin.y, p.Y);
+                        SET_MAX(gridMax.x, p.X);
+                        SET_MAX(gridMax.y, p.Y);
+                    }
+                }
+            }
+            if (supportFaces->faceCount < 1)
+                gridMin = gridMax = placement.vMin;
+        }
+
+        startSupportGrid(storage.support, gridMin, gridMax - gridMin, config.supportAngle, config.supportEverywhere > 0, config.supportXYDistance, config.supportZDistance);
+        supportFaces->rewind();
+        while(supportFaces->readFace(v[0], v[1], v[2]))
+        {
+            if (modelInstances.size() < 1)
+            {
+                addSupportFace(storage.support, v[0], v[1], v[2]);
+                continue;
+            }
+            for(unsigned int i=0; i<modelInstances.size(); i++)
+            {
+                Point3 w[3];
+                for(unsigned int n=0; n<3; n++)
+                {
+                    Point p = transformPoint(Point(v[n].x, v[n].y), instanceMatrix[i], modelInstances[i], center);
+                    w[n] = Point3(p.X, p.Y, v[n].z);
+                }
+                addSupportFace(storage.support, w[0], w[1], w[2]);
+            }
+        }
+        finishSupportGrid(storage.support);
+    }
+
+    //Print the finished parts at every instance. Arranged copies have to end up on the build plate, which is checked on the grown model bounds.
+    void placeModelInstances(SliceDataStorage& storage)
+    {
+        setModelInstances(storage, modelInstances, config.objectPosition.p());
+        if (config.arrangeCount == 0)
+            return;
+        if (storage.modelMin.x < 0 || storage.modelMin.y < 0 || storage.modelMax.x > config.machineWidth || storage.modelMax.y > config.machineDepth)
+            cLogError("Arranged copies do not fit on the build plate: %0.1f,%0.1f to %0.1f,%0.1f\n", INT2MM(storage.modelMin.x), INT2MM(storage.modelMin.y), INT2MM(storage.modelMax.x), INT2MM(storage.modelMax.y));
+    }
+
+    //Place copies of the model on the build plate when asked to, by the footprint of the slices.
+    void arrangeModel(vector<Slicer*>& slicerList)
+    {
+        if (config.arrangeCount == 0)
+            return;
+
+        //The footprint is every layer of every volume seen from above, holes are filled so no copy is placed inside another one.
+        Polygons footprint;
+        for(unsigned int volumeIdx=0; volumeIdx < slicerList.size(); volumeIdx++)
+            for(unsigned int layerNr=0; layerNr<slicerList[volumeIdx]->layers.size(); layerNr++)
+                footprint = footprint.unionPolygons(slicerList[volumeIdx]->layers[layerNr].polygonList);
+        for(unsigned int n=0; n<footprint.size(); n++)
+        {
+            if (!footprint[n].orientation())
+                footprint.remove(n--);
+        }
+        //Keep the skirt or raft around all copies on the plate.
+        int margin = 0;
+        if (config.raftBaseThickness > 0 && config.raftInterfaceThickness > 0)
+            margin = config.raftMargin + config.raftBaseLinewidth;
+        else if (config.skirtLineCount > 0)
+            margin = config.skirtDistance + config.skirtLineCount * config.layer0extrusionWidth;
+        int placed = arrangeModelInstances(footprint, config.objectPosition.p(), Point(config.machineWidth, config.machineDepth), config.arrangeSpacing, margin, config.arrangeCount, modelInstances);
+        if (placed < config.arrangeCount || placed < 1)
+            cLogError("Only %i of the copies fit on the build plate\n", placed);
+        cLog("Arranged %i copies in %5.3fs\n", placed, timeKeeper.restart());
+    }
+
+    //Turn the slices of every volume into layer parts, the slicers are deleted afterwards.
+    void createVolumeLayerParts(SliceDataStorage& storage, vector<Slicer*>& slicerList)
+    {
         cLog("Generating layer parts...\n");
         for(unsigned int volumeIdx=0; volumeIdx < slicerList.size(); volumeIdx++)
         {
@@ -223,7 +592,38 @@ private:
         cura::PolygonHelper::savePartsToFile(storage);
 #endif
         cLog("Generated layer parts in %5.3fs\n", timeKeeper.restart());
-        return true;
+    }
+
+    //With adaptive layers the skin has to be as thick as skinCount normal layers, so count the layers from layerNr in the given direction that make up that height.
+    int skinLayerCount(SliceDataStorage& storage, int layerNr, int skinCount, int direction)
+    {
+        if (config.adaptiveLayerCuspHeight <= 0)
+            return skinCount;
+        return heightLayerCount(storage, layerNr, skinCount * config.layerThickness, direction);
+    }
+
+    //Number of layers from layerNr in the given direction that together are at least height thick.
+    int heightLayerCount(SliceDataStorage& storage, int layerNr, int height, int direction)
+    {
+        int count = 0;
+        for(int n = layerNr; height > 0; n += direction)
+        {
+            if (n >= 0 && n < static_cast<int>(storage.layerHeights.size()))
+                height -= storage.layerHeights[n].thickness;
+            else
+                height -= config.layerThickness;
+            count++;
+        }
+        return count;
+    }
+
+    //Height of the sparse infill that is printed on this layer when the infill of the layers below is combined with it.
+    int combinedSparseThickness(SliceDataStorage& storage, int layerNr)
+    {
+        int thickness = 0;
+        for(int n = std::max(layerNr - config.sparseInfillCombineCount + 1, 0); n <= layerNr; n++)
+            thickness += storage.layerHeights[n].thickness;
+        return thickness;
     }
 
     void processSliceData(SliceDataStorage& storage)
@@ -235,6 +635,7 @@ private:
         //dumpLayerparts(storage, "c:/models/output.html");
         if (config.simpleMode)
         {
+            placeModelInstances(storage);
             for(unsigned int layerNr=0; layerNr<totalLayers; layerNr++)
             {
                 for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
@@ -242,25 +643,37 @@ private:
                     SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
                     for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
                     {
-                        sendPolygonsToGui("inset0", layerNr, layer->printZ, layer->parts[partNr].outline);
+                        for(int instanceNr=0; instanceNr<placedInstanceCount(storage); instanceNr++)
+                        {
+                            Polygons outline = layer->parts[partNr].outline;
+                            placePolygons(storage, outline, instanceNr);
+                            sendPolygonsToGui("inset0", layerNr, layer->printZ, outline);
+                        }
                     }
                 }
             }
             return;
         }
 
+        int previousInsetCount = -1;
+        int previousExtrusionWidth = -1;
         for(unsigned int layerNr=0; layerNr<totalLayers; layerNr++)
         {
+            int insetCount = config.insetCount;
+            if (config.spiralizeMode && static_cast<int>(layerNr) < config.downSkinCount && layerNr % 2 == 1)//Add extra insets every 2 layers when spiralizing, this makes bottoms of cups watertight.
+                insetCount += 5;
+            int extrusionWidth = config.extrusionWidth;
+            if (layerNr == 0)
+                extrusionWidth = config.layer0extrusionWidth;
+            //Identical parts can only copy the insets of the previous layer when those insets were made with the same settings.
+            bool reusePreviousLayer = insetCount == previousInsetCount && extrusionWidth == previousExtrusionWidth;
+            previousInsetCount = insetCount;
+            previousExtrusionWidth = extrusionWidth;
             for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
             {
-                int insetCount = config.insetCount;
-                if (config.spiralizeMode && static_cast<int>(layerNr) < config.downSkinCount && layerNr % 2 == 1)//Add extra insets every 2 layers when spiralizing, this makes bottoms of cups watertight.
-                    insetCount += 5;
                 SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
-                int extrusionWidth = config.extrusionWidth;
-                if (layerNr == 0)
-                    extrusionWidth = config.layer0extrusionWidth;
-                generateInsets(layer, extrusionWidth, insetCount);
+                SliceLayer* previousLayer = reusePreviousLayer ? &storage.volumes[volumeIdx].layers[layerNr - 1] : nullptr;
+                generateInsets(layer, extrusionWidth, insetCount, config.outlineSimplifyTolerance, previousLayer);
 
                 for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
                 {
@@ -274,6 +687,71 @@ private:
             }
             cLogProgress("inset",layerNr+1,totalLayers);
         }
+        cLog("Generated inset in %5.3fs\n", timeKeeper.restart());
+
+        for(unsigned int layerNr=0; layerNr<totalLayers; layerNr++)
+        {
+            if (!config.spiralizeMode || static_cast<int>(layerNr) < config.downSkinCount)    //Only generate up/downskin and infill for the first X layers when spiralize is choosen.
+            {
+                for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+                {
+                    int extrusionWidth = config.extrusionWidth;
+                    if (layerNr == 0)
+                        extrusionWidth = config.layer0extrusionWidth;
+                    int downSkinCount = skinLayerCount(storage, layerNr, config.downSkinCount, -1);
+                    int upSkinCount = skinLayerCount(storage, layerNr, config.upSkinCount, 1);
+                    generateSkins(layerNr, storage.volumes[volumeIdx], extrusionWidth, downSkinCount, upSkinCount, config.infillOverlap);
+                    generateSparse(layerNr, storage.volumes[volumeIdx], extrusionWidth, downSkinCount, upSkinCount);
+
+                    SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
+                    for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+                        sendPolygonsToGui("skin", layerNr, layer->printZ, layer->parts[partNr].skinOutline);
+                }
+            }
+            cLogProgress("skin",layerNr+1,totalLayers);
+        }
+        cLog("Generated up/down skin in %5.3fs\n", timeKeeper.restart());
+
+        if (config.sparseInfillSupportOnly && !config.spiralizeMode)
+        {
+            vector<Polygons> supportedAreas(storage.volumes.size());
+            for(int layerNr=totalLayers-1; layerNr>=0; layerNr--)
+            {
+                int overhangOffset = tan(config.sparseInfillSupportAngle * M_PI / 180) * storage.layerHeights[layerNr].thickness;
+                for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+                    generateSupportOnlySparse(layerNr, storage.volumes[volumeIdx], supportedAreas[volumeIdx], overhangOffset);
+            }
+            cLog("Generated support only infill in %5.3fs\n", timeKeeper.restart());
+        }
+
+        if (config.gradualInfillSteps > 0 && config.gradualInfillStepHeight > 0 && !config.spiralizeMode)
+        {
+            for(unsigned int layerNr=0; layerNr<totalLayers; layerNr++)
+            {
+                int stepLayerCount = std::max(heightLayerCount(storage, layerNr, config.gradualInfillStepHeight, 1), 1);
+                for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+                    generateGradualSparse(layerNr, storage.volumes[volumeIdx], config.gradualInfillSteps, stepLayerCount, config.extrusionWidth);
+            }
+            cLog("Generated gradual infill in %5.3fs\n", timeKeeper.restart());
+        }
+
+        if (config.sparseInfillCombineCount > 1 && !config.spiralizeMode)
+        {
+            //The first layer is printed on its own, the groups of combined layers start at layer 1.
+            int combineCount = config.sparseInfillCombineCount;
+            for(unsigned int layerNr=combineCount; layerNr<totalLayers; layerNr+=combineCount)
+            {
+                if (combinedSparseThickness(storage, layerNr) > config.nozzleSize)
+                    continue;
+                for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
+                    combineSparseLayers(layerNr, storage.volumes[volumeIdx], combineCount, config.extrusionWidth);
+            }
+            cLog("Combined sparse infill in %5.3fs\n", timeKeeper.restart());
+        }
+
+        //The model is processed once, the finished parts are printed at every instance.
+        placeModelInstances(storage);
+
         if (config.enableOozeShield)
         {
             for(unsigned int layerNr=0; layerNr<totalLayers; layerNr++)
@@ -283,7 +761,13 @@ private:
                 {
                     for(unsigned int partNr=0; partNr<storage.volumes[volumeIdx].layers[layerNr].parts.size(); partNr++)
                     {
-                        oozeShield = oozeShield.unionPolygons(storage.volumes[volumeIdx].layers[layerNr].parts[partNr].outline.offset(MM2INT(2.0)));
+                        Polygons outline = storage.volumes[volumeIdx].layers[layerNr].parts[partNr].outline.offset(MM2INT(2.0));
+                        for(int instanceNr=0; instanceNr<placedInstanceCount(storage); instanceNr++)
+                        {
+                            Polygons placed = outline;
+                            placePolygons(storage, placed, instanceNr);
+                            oozeShield = oozeShield.unionPolygons(placed);
+                        }
                     }
                 }
                 storage.oozeShield.push_back(oozeShield);
@@ -297,28 +781,6 @@ private:
             for(unsigned int layerNr=totalLayers-1; layerNr>0; layerNr--)
                 storage.oozeShield[layerNr-1] = storage.oozeShield[layerNr-1].unionPolygons(storage.oozeShield[layerNr].offset(-offsetAngle));
         }
-        cLog("Generated inset in %5.3fs\n", timeKeeper.restart());
-
-        for(unsigned int layerNr=0; layerNr<totalLayers; layerNr++)
-        {
-            if (!config.spiralizeMode || static_cast<int>(layerNr) < config.downSkinCount)    //Only generate up/downskin and infill for the first X layers when spiralize is choosen.
-            {
-                for(unsigned int volumeIdx=0; volumeIdx<storage.volumes.size(); volumeIdx++)
-                {
-                    int extrusionWidth = config.extrusionWidth;
-                    if (layerNr == 0)
-                        extrusionWidth = config.layer0extrusionWidth;
-                    generateSkins(layerNr, storage.volumes[volumeIdx], extrusionWidth, config.downSkinCount, config.upSkinCount, config.infillOverlap);
-                    generateSparse(layerNr, storage.volumes[volumeIdx], extrusionWidth, config.downSkinCount, config.upSkinCount);
-
-                    SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
-                    for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
-                        sendPolygonsToGui("skin", layerNr, layer->printZ, layer->parts[partNr].skinOutline);
-                }
-            }
-            cLogProgress("skin",layerNr+1,totalLayers);
-        }
-        cLog("Generated up/down skin in %5.3fs\n", timeKeeper.restart());
 
         if (config.wipeTowerSize > 0)
         {
@@ -371,6 +833,7 @@ private:
 
         unsigned int totalLayers = storage.volumes[0].layers.size();
         gcode.writeComment("Layer count: %d", totalLayers);
+        layerCount += totalLayers;
 
         if (config.raftBaseThickness > 0 && config.raftInterfaceThickness > 0)
         {
@@ -386,8 +849,8 @@ private:
                 gcode.writeComment("LAYER:-2");
                 gcode.writeComment("RAFT");
                 GCodePlanner gcodeLayer(gcode, config.moveSpeed, config.retractionMinimalDistance);
-                if (config.supportExtruder > 0)
-                    gcodeLayer.setExtruder(config.supportExtruder);
+                if (supportExtruderNr() > 0)
+                    gcodeLayer.setExtruder(supportExtruderNr());
                 gcode.setZ(config.raftBaseThickness);
                 gcode.setExtrusion(config.raftBaseThickness, config.filamentDiameter, config.filamentFlow);
 
@@ -435,7 +898,32 @@ private:
             }
         }
 
-        int volumeIdx = 0;
+        //Plan the extruder order of every layer up front, so each layer ends with an extruder the next layer starts with.
+        //Every volume is printed with the extruder of the same number, volumes without an extruder are not printed.
+        unsigned int volumeCount = std::min<unsigned int>(storage.volumes.size(), MAX_EXTRUDERS);
+        if (volumeCount < storage.volumes.size())
+            cLogError("Only the first %i volumes are printed, there are no more extruders\n", MAX_EXTRUDERS);
+        int supportExtruder = supportExtruderNr();
+        vector<Polygons> supportLayers(totalLayers);
+        vector<unsigned int> layerExtruders(totalLayers, 0);
+        for(unsigned int layerNr=0; layerNr<totalLayers; layerNr++)
+        {
+            for(unsigned int volumeIdx=0; volumeIdx<volumeCount; volumeIdx++)
+            {
+                if (volumeLayerHasContent(storage, volumeIdx, layerNr))
+                    layerExtruders[layerNr] |= 1 << volumeIdx;
+            }
+            if (storage.support.generated)
+            {
+                supportLayers[layerNr] = generateSupportLayer(storage, layerNr);
+                if (supportExtruder > -1 && supportLayers[layerNr].size() > 0)
+                    layerExtruders[layerNr] |= 1 << supportExtruder;
+            }
+        }
+        vector<vector<int> > layerExtruderOrder;
+        int extruderSwitchCount = planExtruderOrder(gcode.getExtruderNr(), layerExtruders, layerExtruderOrder);
+        cLog("Planned %i extruder switches in %5.3fs\n", extruderSwitchCount, timeKeeper.restart());
+
         for(unsigned int layerNr=0; layerNr<totalLayers; layerNr++)
         {
             cLogProgress("export", layerNr+1, totalLayers);
@@ -465,13 +953,14 @@ private:
             }
 
             gcode.writeComment("LAYER:%d", layerNr);
-            if (layerNr == 0)
-                gcode.setExtrusion(config.initialLayerThickness, config.filamentDiameter, config.filamentFlow);
-            else
-                gcode.setExtrusion(config.layerThickness, config.filamentDiameter, config.filamentFlow);
+            int layerThickness = storage.layerHeights[layerNr].thickness;
+            gcode.setExtrusion(layerThickness, config.filamentDiameter, config.filamentFlow);
+            //Combined infill is as high as all the layers it is printed for, which is extruded as a wider line at the thickness of this layer.
+            combinedInfillConfig.setData(infillConfig.speed, infillConfig.lineWidth * combinedSparseThickness(storage, layerNr) / layerThickness, "FILL");
 
             GCodePlanner gcodeLayer(gcode, config.moveSpeed, config.retractionMinimalDistance);
-            int32_t z = config.initialLayerThickness + layerNr * config.layerThickness;
+            gcodeLayer.setPathOrderCache(&pathOrderCache);
+            int32_t z = storage.layerHeights[layerNr].printZ;
             z += config.raftBaseThickness + config.raftInterfaceThickness + config.raftSurfaceLayers*config.raftSurfaceThickness;
             if (config.raftBaseThickness > 0 && config.raftInterfaceThickness > 0)
             {
@@ -485,18 +974,30 @@ private:
             gcode.setZ(z);
             gcode.resetStartPosition();
 
-            bool printSupportFirst = (storage.support.generated && config.supportExtruder > 0 && config.supportExtruder == gcodeLayer.getExtruder());
-            if (printSupportFirst)
-                addSupportToGCode(storage, gcodeLayer, layerNr);
+            vector<int>& extruderOrder = layerExtruderOrder[layerNr];
+            if (layerNr == 0 && !(config.raftBaseThickness > 0 && config.raftInterfaceThickness > 0))
+            {
+                //The skirt primes the extruder that prints first, or the current one when the first layer is empty.
+                int prevExtruder = gcodeLayer.getExtruder();
+                bool extruderChanged = extruderOrder.size() > 0 && gcodeLayer.setExtruder(extruderOrder[0]);
+                if (storage.skirt.size() > 0)
+                    gcodeLayer.addTravel(storage.skirt[storage.skirt.size()-1].closestPointTo(gcode.getPositionXY()));
+                gcodeLayer.addPolygonsByOptimizer(storage.skirt, &skirtConfig);
+                if (extruderChanged)
+                    addWipeTower(storage, gcodeLayer, layerNr, prevExtruder);
+            }
 
-            for(unsigned int volumeCnt = 0; volumeCnt < storage.volumes.size(); volumeCnt++)
+            //Each extruder prints its volume and, when it is the support extruder, the support right after it.
+            for(unsigned int orderNr = 0; orderNr < extruderOrder.size(); orderNr++)
             {
-                if (volumeCnt > 0)
-                    volumeIdx = (volumeIdx + 1) % storage.volumes.size();
-                addVolumeLayerToGCode(storage, gcodeLayer, volumeIdx, layerNr);
+                int extruderNr = extruderOrder[orderNr];
+                if (extruderNr < static_cast<int>(volumeCount) && volumeLayerHasContent(storage, extruderNr, layerNr))
+                    addVolumeLayerToGCode(storage, gcodeLayer, extruderNr, layerNr);
+                if (storage.support.generated && extruderNr == supportExtruder)
+                    addSupportToGCode(storage, gcodeLayer, layerNr, supportLayers[layerNr]);
             }
-            if (!printSupportFirst)
-                addSupportToGCode(storage, gcodeLayer, layerNr);
+            if (storage.support.generated && supportExtruder < 0)
+                addSupportToGCode(storage, gcodeLayer, layerNr, supportLayers[layerNr]);
 
             //Finish the layer by applying speed corrections for minimal layer times
             gcodeLayer.forceMinimalLayerTime(config.minimalLayerTime, config.minimalFeedrate);
@@ -516,7 +1017,8 @@ private:
             }
             gcode.writeFanCommand(fanSpeed);
 
-            gcodeLayer.writeGCode(config.coolHeadLift > 0, static_cast<int>(layerNr) > 0 ? config.layerThickness : config.initialLayerThickness);
+            gcodeLayer.writeGCode(config.coolHeadLift > 0, layerThickness);
+            gcode.flushStream();
         }
 
         cLog("Wrote layers in %5.2fs.\n", timeKeeper.restart());
@@ -532,12 +1034,6 @@ private:
     {
         int prevExtruder = gcodeLayer.getExtruder();
         bool extruderChanged = gcodeLayer.setExtruder(volumeIdx);
-        if (layerNr == 0 && volumeIdx == 0 && !(config.raftBaseThickness > 0 && config.raftInterfaceThickness > 0))
-        {
-            if (storage.skirt.size() > 0)
-                gcodeLayer.addTravel(storage.skirt[storage.skirt.size()-1].closestPointTo(gcode.getPositionXY()));
-            gcodeLayer.addPolygonsByOptimizer(storage.skirt, &skirtConfig);
-        }
 
         SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
         if (extruderChanged)
@@ -584,66 +1080,99 @@ private:
                     polygons.add(p);
                 }
             }
+            Polygons placedPolygons;
+            for(int instanceNr=0; instanceNr<placedInstanceCount(storage); instanceNr++)
+            {
+                Polygons placed = polygons;
+                placePolygons(storage, placed, instanceNr);
+                placedPolygons.add(placed);
+            }
             if (config.spiralizeMode)
                 inset0Config.spiralize = true;
             
-            gcodeLayer.addPolygonsByOptimizer(polygons, &inset0Config);
+            gcodeLayer.addPolygonsByOptimizer(placedPolygons, &inset0Config);
             return;
         }
 
 
-        PathOrderOptimizer partOrderOptimizer(gcode.getStartPositionXY());
-        for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+        //Every part is printed at every instance of the model. The parts are stored once, their paths are generated once per layer and moved to each instance.
+        int instanceCount = placedInstanceCount(storage);
+        int partCount = layer->parts.size();
+        Polygons placedOutlines;
+        for(int instanceNr=0; instanceNr<instanceCount; instanceNr++)
         {
-            partOrderOptimizer.addPolygon(layer->parts[partNr].insets[0][0]);
+            for(int partNr=0; partNr<partCount; partNr++)
+            {
+                Polygons outline;
+                outline.add(layer->parts[partNr].insets[0][0]);
+                placePolygons(storage, outline, instanceNr);
+                placedOutlines.add(outline);
+            }
+        }
+        PartOrderOptimizer partOrderOptimizer(gcode.getStartPositionXY(), retractionTravelCost(), config.retractionMinimalDistance);
+        for(unsigned int n=0; n<placedOutlines.size(); n++)
+        {
+            partOrderOptimizer.addPart(placedOutlines[n]);
+        }
+        if (layerNr + 1 < static_cast<int>(storage.volumes[volumeIdx].layers.size()))
+        {
+            SliceLayer* nextLayer = &storage.volumes[volumeIdx].layers[layerNr + 1];
+            for(int instanceNr=0; instanceNr<instanceCount; instanceNr++)
+                for(unsigned int partNr=0; partNr<nextLayer->parts.size(); partNr++)
+                    partOrderOptimizer.nextLayerPoints.push_back(placePoint(storage, (nextLayer->parts[partNr].boundaryBox.min + nextLayer->parts[partNr].boundaryBox.max) / 2, instanceNr));
         }
         partOrderOptimizer.optimize();
 
+        int fillAngle = 45;
+        if (layerNr & 1)
+            fillAngle += 90;
+        int extrusionWidth = config.extrusionWidth;
+        if (layerNr == 0)
+            extrusionWidth = config.layer0extrusionWidth;
+
+        vector<PartPaths> partPaths(partCount);
+        Polygons combBoundary;
         for(unsigned int partCounter=0; partCounter<partOrderOptimizer.polyOrder.size(); partCounter++)
         {
-            SliceLayerPart* part = &layer->parts[partOrderOptimizer.polyOrder[partCounter]];
+            int instanceNr = partOrderOptimizer.polyOrder[partCounter] / partCount;
+            int partNr = partOrderOptimizer.polyOrder[partCounter] % partCount;
+            SliceLayerPart* part = &layer->parts[partNr];
+            PartPaths& paths = partPaths[partNr];
+            if (!paths.generated)
+                generatePartPaths(storage, volumeIdx, layerNr, part, extrusionWidth, fillAngle, paths);
 
             if (config.enableCombing == COMBING_OFF)
             {
                 gcodeLayer.setAlwaysRetract(true);
             }else
             {
-                gcodeLayer.setCombBoundary(&part->combBoundery);
+                combBoundary = part->combBoundery;
+                placePolygons(storage, combBoundary, instanceNr);
+                gcodeLayer.setCombBoundary(&combBoundary);
                 gcodeLayer.setAlwaysRetract(false);
             }
 
-            int fillAngle = 45;
-            if (layerNr & 1)
-                fillAngle += 90;
-            int extrusionWidth = config.extrusionWidth;
-            if (layerNr == 0)
-                extrusionWidth = config.layer0extrusionWidth;
+            vector<Polygons> insets = part->insets;
+            for(unsigned int insetNr=0; insetNr<insets.size(); insetNr++)
+                placePolygons(storage, insets[insetNr], instanceNr);
 
             // Add either infill or perimeter first depending on option
             if (!config.perimeterBeforeInfill) 
             {
-                addInfillToGCode(part, gcodeLayer, layerNr, extrusionWidth, fillAngle);
-                addInsetToGCode(part, gcodeLayer, layerNr);
+                addInfillToGCode(storage, paths, gcodeLayer, instanceNr);
+                addInsetToGCode(insets, gcodeLayer, layerNr);
             }else
             {
-                addInsetToGCode(part, gcodeLayer, layerNr);
-                addInfillToGCode(part, gcodeLayer, layerNr, extrusionWidth, fillAngle);
+                addInsetToGCode(insets, gcodeLayer, layerNr);
+                addInfillToGCode(storage, paths, gcodeLayer, instanceNr);
             }
             
-            Polygons skinPolygons;
-            for(Polygons outline : part->skinOutline.splitIntoParts())
-            {
-                int bridge = -1;
-                if (layerNr > 0)
-                    bridge = bridgeAngle(outline, &storage.volumes[volumeIdx].layers[layerNr-1]);
-                generateLineInfill(outline, skinPolygons, extrusionWidth, extrusionWidth, config.infillOverlap, (bridge > -1) ? bridge : fillAngle);
-            }
             if (config.enableCombing == COMBING_NOSKIN)
             {
                 gcodeLayer.setCombBoundary(nullptr);
                 gcodeLayer.setAlwaysRetract(true);
             }
-            gcodeLayer.addPolygonsByOptimizer(skinPolygons, &skinConfig);
+            addPlacedPolygons(storage, paths.skin, gcodeLayer, instanceNr, &skinConfig);
 
 
             //After a layer part, make sure the nozzle is inside the comb boundary, so we do not retract on the perimeter.
@@ -653,46 +1182,54 @@ private:
         gcodeLayer.setCombBoundary(nullptr);
     }
 
-    void addInfillToGCode(SliceLayerPart* part, GCodePlanner& gcodeLayer, int layerNr, int extrusionWidth, int fillAngle)
+    //Generate the infill and skin lines of a part where the model is, they are moved to every instance when the part is printed.
+    void generatePartPaths(SliceDataStorage& storage, int volumeIdx, int layerNr, SliceLayerPart* part, int extrusionWidth, int fillAngle, PartPaths& paths)
     {
-        Polygons infillPolygons;
+        paths.generated = true;
         if (config.sparseInfillLineDistance > 0)
         {
-            switch (config.infillPattern)
-            {
-                case INFILL_AUTOMATIC:
-                    generateAutomaticInfill(
-                        part->sparseOutline, infillPolygons, extrusionWidth,
-                        config.sparseInfillLineDistance,
-                        config.infillOverlap, fillAngle);
-                    break;
+            infillCache.generate(part->sparseOutline, paths.infill, config.infillPattern, extrusionWidth, config.sparseInfillLineDistance, config.infillOverlap, fillAngle);
+            paths.gradualInfill.resize(part->gradualSparseOutlines.size());
+            for(unsigned int stepNr=0; stepNr<part->gradualSparseOutlines.size(); stepNr++)
+                infillCache.generate(part->gradualSparseOutlines[stepNr], paths.gradualInfill[stepNr], config.infillPattern, extrusionWidth, config.sparseInfillLineDistance << (stepNr + 1), config.infillOverlap, fillAngle);
+            if (part->combinedSparseOutline.size() > 0)
+                infillCache.generate(part->combinedSparseOutline, paths.combinedInfill, config.infillPattern, extrusionWidth, config.sparseInfillLineDistance, config.infillOverlap, fillAngle);
+        }
 
-                case INFILL_GRID:
-                    generateGridInfill(part->sparseOutline, infillPolygons,
-                                       extrusionWidth,
-                                       config.sparseInfillLineDistance,
-                                       config.infillOverlap, fillAngle);
-                    break;
+        for(Polygons outline : part->skinOutline.splitIntoParts())
+        {
+            int bridge = -1;
+            if (layerNr > 0)
+                bridge = bridgeAngle(outline, &storage.volumes[volumeIdx].layers[layerNr-1]);
+            infillCache.generate(outline, paths.skin, INFILL_LINES, extrusionWidth, extrusionWidth, config.infillOverlap, (bridge > -1) ? bridge : fillAngle);
+        }
+    }
 
-                case INFILL_LINES:
-                    generateLineInfill(part->sparseOutline, infillPolygons,
-                                       extrusionWidth,
-                                       config.sparseInfillLineDistance,
-                                       config.infillOverlap, fillAngle);
-                    break;
+    void addPlacedPolygons(SliceDataStorage& storage, Polygons& polygons, GCodePlanner& gcodeLayer, int instanceNr, GCodePathConfig* pathConfig)
+    {
+        Polygons placed = polygons;
+        placePolygons(storage, placed, instanceNr);
+        gcodeLayer.addPolygonsByOptimizer(placed, pathConfig);
+    }
 
-                case INFILL_CONCENTRIC:
-                    generateConcentricInfill(
-                        part->sparseOutline, infillPolygons,
-                        config.sparseInfillLineDistance);
-                    break;
-            }
-        }
+    //The time a retraction and z-hop take, as the distance a travel move covers in that time.
+    int64_t retractionTravelCost()
+    {
+        if (config.retractionAmount <= 0 || config.retractionSpeed <= 0)
+            return 0;
+        return int64_t(config.moveSpeed) * (2 * int64_t(config.retractionAmount) + 2 * int64_t(config.retractionZHop)) / config.retractionSpeed;
+    }
 
-        gcodeLayer.addPolygonsByOptimizer(infillPolygons, &infillConfig);
+    void addInfillToGCode(SliceDataStorage& storage, PartPaths& paths, GCodePlanner& gcodeLayer, int instanceNr)
+    {
+        addPlacedPolygons(storage, paths.infill, gcodeLayer, instanceNr, &infillConfig);
+        for(unsigned int stepNr=0; stepNr<paths.gradualInfill.size(); stepNr++)
+            addPlacedPolygons(storage, paths.gradualInfill[stepNr], gcodeLayer, instanceNr, &infillConfig);
+        if (paths.combinedInfill.size() > 0)
+            addPlacedPolygons(storage, paths.combinedInfill, gcodeLayer, instanceNr, &combinedInfillConfig);
     }
 
-    void addInsetToGCode(SliceLayerPart* part, GCodePlanner& gcodeLayer, int layerNr)
+    void addInsetToGCode(vector<Polygons>& insets, GCodePlanner& gcodeLayer, int layerNr)
     {
         if (config.insetCount > 0)
         {
@@ -700,28 +1237,67 @@ private:
             {
                 if (static_cast<int>(layerNr) >= config.downSkinCount)
                     inset0Config.spiralize = true;
-                if (static_cast<int>(layerNr) == config.downSkinCount && part->insets.size() > 0)
-                    gcodeLayer.addPolygonsByOptimizer(part->insets[0], &insetXConfig);
+                if (static_cast<int>(layerNr) == config.downSkinCount && insets.size() > 0)
+                    gcodeLayer.addPolygonsByOptimizer(insets[0], &insetXConfig);
             }
-            for(int insetNr=part->insets.size()-1; insetNr>-1; insetNr--)
+            for(int insetNr=insets.size()-1; insetNr>-1; insetNr--)
             {
                 if (insetNr == 0)
-                    gcodeLayer.addPolygonsByOptimizer(part->insets[insetNr], &inset0Config);
+                    gcodeLayer.addPolygonsByOptimizer(insets[insetNr], &inset0Config);
                 else
-                    gcodeLayer.addPolygonsByOptimizer(part->insets[insetNr], &insetXConfig);
+                    gcodeLayer.addPolygonsByOptimizer(insets[insetNr], &insetXConfig);
             }
         }
     }
 
-    void addSupportToGCode(SliceDataStorage& storage, GCodePlanner& gcodeLayer, int layerNr)
+    //The extruder that prints the support, or -1 when the support is printed by whichever extruder is active.
+    int supportExtruderNr()
+    {
+        if (config.supportExtruder < 0 || config.supportExtruder >= MAX_EXTRUDERS)
+            return -1;
+        return config.supportExtruder;
+    }
+
+    bool volumeLayerHasContent(SliceDataStorage& storage, int volumeIdx, int layerNr)
+    {
+        SliceLayer* layer = &storage.volumes[volumeIdx].layers[layerNr];
+        return layer->parts.size() > 0 || layer->openLines.size() > 0;
+    }
+
+    //Support of a single layer, with the model and its XY distance cut away.
+    Polygons generateSupportLayer(SliceDataStorage& storage, int layerNr)
+    {
+        int32_t z = storage.layerHeights[layerNr].printZ;
+        SupportPolyGenerator supportGenerator(storage.support, z);
+        for(unsigned int volumeCnt = 0; volumeCnt < storage.volumes.size(); volumeCnt++)
+        {
+            SliceLayer* layer = &storage.volumes[volumeCnt].layers[layerNr];
+            for(unsigned int n=0; n<layer->parts.size(); n++)
+            {
+                Polygons outline = layer->parts[n].outline.offset(config.supportXYDistance);
+                for(int instanceNr=0; instanceNr<placedInstanceCount(storage); instanceNr++)
+                {
+                    Polygons placed = outline;
+                    placePolygons(storage, placed, instanceNr);
+                    supportGenerator.polygons = supportGenerator.polygons.difference(placed);
+                }
+            }
+        }
+        //Contract and expand the suppory polygons so small sections are removed and the final polygon is smoothed a bit.
+        supportGenerator.polygons = supportGenerator.polygons.offset(-config.extrusionWidth * 3);
+        supportGenerator.polygons = supportGenerator.polygons.offset(config.extrusionWidth * 3);
+        return supportGenerator.polygons;
+    }
+
+    void addSupportToGCode(SliceDataStorage& storage, GCodePlanner& gcodeLayer, int layerNr, Polygons& supportPolygons)
     {
         if (!storage.support.generated)
             return;
 
-        if (config.supportExtruder > -1)
+        if (supportExtruderNr() > -1)
         {
             int prevExtruder = gcodeLayer.getExtruder();
-            if (gcodeLayer.setExtruder(config.supportExtruder))
+            if (gcodeLayer.setExtruder(supportExtruderNr()))
                 addWipeTower(storage, gcodeLayer, layerNr, prevExtruder);
 
             if (storage.oozeShield.size() > 0 && storage.volumes.size() == 1)
@@ -731,25 +1307,14 @@ private:
                 gcodeLayer.setAlwaysRetract(!config.enableCombing);
             }
         }
-        int32_t z = config.initialLayerThickness + layerNr * config.layerThickness;
-        SupportPolyGenerator supportGenerator(storage.support, z);
-        for(unsigned int volumeCnt = 0; volumeCnt < storage.volumes.size(); volumeCnt++)
-        {
-            SliceLayer* layer = &storage.volumes[volumeCnt].layers[layerNr];
-            for(unsigned int n=0; n<layer->parts.size(); n++)
-                supportGenerator.polygons = supportGenerator.polygons.difference(layer->parts[n].outline.offset(config.supportXYDistance));
-        }
-        //Contract and expand the suppory polygons so small sections are removed and the final polygon is smoothed a bit.
-        supportGenerator.polygons = supportGenerator.polygons.offset(-config.extrusionWidth * 3);
-        supportGenerator.polygons = supportGenerator.polygons.offset(config.extrusionWidth * 3);
-        sendPolygonsToGui("support", layerNr, z, supportGenerator.polygons);
+        sendPolygonsToGui("support", layerNr, storage.layerHeights[layerNr].printZ, supportPolygons);
 
-        vector<Polygons> supportIslands = supportGenerator.polygons.splitIntoParts();
+        vector<Polygons> supportIslands = supportPolygons.splitIntoParts();
 
-        PathOrderOptimizer islandOrderOptimizer(gcode.getPositionXY());
+        PartOrderOptimizer islandOrderOptimizer(gcode.getPositionXY(), retractionTravelCost(), config.retractionMinimalDistance);
         for(unsigned int n=0; n<supportIslands.size(); n++)
         {
-            islandOrderOptimizer.addPolygon(supportIslands[n][0]);
+            islandOrderOptimizer.addPart(supportIslands[n][0]);
         }
         islandOrderOptimizer.optimize();
 
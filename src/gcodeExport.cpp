@@ -1,12 +1,14 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include <stdarg.h>
 #include <stdio.h>
+#include <algorithm>
 
 #include "gcodeExport.h"
 #include "pathOrderOptimizer.h"
 #include "timeEstimate.h"
 #include "settings.h"
 #include "utils/logoutput.h"
+#include "utils/cura_string.h"
 
 namespace cura {
 
@@ -30,38 +32,54 @@ GCodeExport::GCodeExport()
     retractionSpeed = 45;
     isRetracted = false;
     setFlavor(GCODE_FLAVOR_REPRAP);
+    arcFittingTolerance = 0;
+    estimateOnly = false;
     memset(extruderOffset, 0, sizeof(extruderOffset));
     f = stdout;
+    seekable = false;
+    gzip = nullptr;
 }
 
 GCodeExport::~GCodeExport()
 {
+#ifdef HAVE_ZLIB
+    delete gzip;
+#endif
     if (f && f != stdout)
         fclose(f);
 }
 
-void GCodeExport::replaceTagInStart(const char* tag, const char* replaceValue)
+bool GCodeExport::replaceTagInStart(const char* tag, const char* replaceValue)
 {
-    if (f == stdout)
+    if (estimateOnly)
+        return true;
+    if (!seekable)
     {
         cLog("Replace:%s:%s\n", tag, replaceValue);
-        return;
+        return false;
     }
+    fflush(f);
     fpos_t oldPos;
     fgetpos(f, &oldPos);
     
     char buffer[1024];
     fseek(f, 0, SEEK_SET);
-    fread(buffer, 1024, 1, f);
+    size_t length = fread(buffer, 1, sizeof(buffer) - 1, f);
+    buffer[length] = '\0';
     
+    //The tag is a fixed width placeholder, only the placeholder itself is rewritten. The value is padded with spaces to the same width.
     char* c = strstr(buffer, tag);
-    memset(c, ' ', strlen(tag));
-    if (c) memcpy(c, replaceValue, strlen(replaceValue));
-    
-    fseek(f, 0, SEEK_SET);
-    fwrite(buffer, 1024, 1, f);
+    if (c)
+    {
+        size_t tagLength = strlen(tag);
+        memset(c, ' ', tagLength);
+        memcpy(c, replaceValue, std::min(tagLength, strlen(replaceValue)));
+        fseek(f, c - buffer, SEEK_SET);
+        fwrite(c, 1, tagLength, f);
+    }
     
     fsetpos(f, &oldPos);
+    return c != nullptr;
 }
 
 void GCodeExport::setExtruderOffset(int id, Point p)
@@ -91,14 +109,82 @@ int GCodeExport::getFlavor()
     return this->flavor;
 }
 
+void GCodeExport::setArcFittingTolerance(int tolerance)
+{
+    this->arcFittingTolerance = tolerance;
+}
+
+int GCodeExport::getArcFittingTolerance()
+{
+    //Makerbot G-code is converted to x3g, which has no arcs. And BFB machines only understand straight moves.
+    if (flavor == GCODE_FLAVOR_MAKERBOT || flavor == GCODE_FLAVOR_BFB)
+        return 0;
+    return arcFittingTolerance;
+}
+
 void GCodeExport::setFilename(const char* filename)
 {
-    f = fopen(filename, "w+");
+    if (strcmp(filename, "-") == 0)
+        f = stdout;
+    else
+        f = fopen(filename, "w+");
+    updateSeekable();
+
+    //Files named *.gz are compressed.
+    const char* ext = strrchr(filename, '.');
+    if (f && ext && stringcasecompare(ext, ".gz") == 0 && !enableCompression())
+        cLogError("Compiled without zlib, %s is written uncompressed.\n", filename);
+}
+
+bool GCodeExport::enableCompression()
+{
+#ifdef HAVE_ZLIB
+    if (gzip == nullptr && f != nullptr)
+        gzip = new GzipStream(f);
+    seekable = false;
+    return gzip != nullptr;
+#else
+    return false;
+#endif
+}
+
+void GCodeExport::setFile(FILE* file)
+{
+    f = file;
+    updateSeekable();
+}
+
+void GCodeExport::updateSeekable()
+{
+    //stdout is never rewritten, even when redirected to a file, as it could be opened in append mode.
+    seekable = f != nullptr && f != stdout && gzip == nullptr && fseek(f, 0, SEEK_CUR) == 0;
+}
+
+bool GCodeExport::isSeekable()
+{
+    return seekable;
+}
+
+void GCodeExport::flushStream()
+{
+    //Compressed output is only flushed at the end, flushing every layer would give tiny compression blocks.
+    if (!estimateOnly && f != nullptr && !seekable && gzip == nullptr)
+        fflush(f);
 }
 
 bool GCodeExport::isOpened()
 {
-    return f != nullptr;
+    return f != nullptr || estimateOnly;
+}
+
+void GCodeExport::setEstimateOnly(bool estimateOnly)
+{
+    this->estimateOnly = estimateOnly;
+}
+
+bool GCodeExport::isEstimateOnly()
+{
+    return estimateOnly;
 }
 
 void GCodeExport::setExtrusion(int layerThickness, int filamentDiameter, int flow)
@@ -165,37 +251,86 @@ double GCodeExport::getTotalFilamentUsed(int e)
 
 double GCodeExport::getTotalPrintTime()
 {
+    flushPrintTimeEstimate();
     return totalPrintTime;
 }
 
 void GCodeExport::updateTotalPrintTime()
 {
-    totalPrintTime += estimateCalculator.calculate();
-    estimateCalculator.reset();
+    //Every layer is a segment of the estimate. Segments are calculated in batches, so the layers of a batch can be estimated in parallel.
+    estimateCalculator.endSegment();
+    if (estimateCalculator.getSegmentCount() >= PRINT_TIME_ESTIMATE_BATCH_SIZE)
+        flushPrintTimeEstimate();
+}
+
+void GCodeExport::flushPrintTimeEstimate()
+{
+    std::vector<double> layerTimes;
+    estimateCalculator.calculate(layerTimes);
+    for(unsigned int n=0; n<layerTimes.size(); n++)
+        totalPrintTime += layerTimes[n];
+}
+
+void GCodeExport::writeRaw(const char* format, ...)
+{
+    if (estimateOnly)
+        return;
+    va_list args;
+    va_start(args, format);
+    writeRawV(format, args);
+    va_end(args);
+}
+
+void GCodeExport::writeRawV(const char* format, va_list args)
+{
+#ifdef HAVE_ZLIB
+    if (gzip)
+    {
+        va_list argsCopy;
+        va_copy(argsCopy, args);
+        if (formatBuffer.size() < 256)
+            formatBuffer.resize(256);
+        int length = vsnprintf(formatBuffer.data(), formatBuffer.size(), format, args);
+        if (length >= int(formatBuffer.size()))
+        {
+            formatBuffer.resize(length + 1);
+            vsnprintf(formatBuffer.data(), formatBuffer.size(), format, argsCopy);
+        }
+        va_end(argsCopy);
+        if (length > 0)
+            gzip->write(formatBuffer.data(), length);
+        return;
+    }
+#endif
+    vfprintf(f, format, args);
 }
 
 void GCodeExport::writeComment(const char* comment, ...)
 {
+    if (estimateOnly)
+        return;
     va_list args;
     va_start(args, comment);
-    fprintf(f, ";");
-    vfprintf(f, comment, args);
+    writeRaw(";");
+    writeRawV(comment, args);
     if (flavor == GCODE_FLAVOR_BFB)
-        fprintf(f, "\r\n");
+        writeRaw("\r\n");
     else
-        fprintf(f, "\n");
+        writeRaw("\n");
     va_end(args);
 }
 
 void GCodeExport::writeLine(const char* line, ...)
 {
+    if (estimateOnly)
+        return;
     va_list args;
     va_start(args, line);
-    vfprintf(f, line, args);
+    writeRawV(line, args);
     if (flavor == GCODE_FLAVOR_BFB)
-        fprintf(f, "\r\n");
+        writeRaw("\r\n");
     else
-        fprintf(f, "\n");
+        writeRaw("\n");
     va_end(args);
 }
 
@@ -203,7 +338,7 @@ void GCodeExport::resetExtrusionValue()
 {
     if (extrusionAmount != 0.0 && flavor != GCODE_FLAVOR_MAKERBOT && flavor != GCODE_FLAVOR_BFB)
     {
-        fprintf(f, "G92 %c0\n", extruderCharacter[extruderNr]);
+        writeRaw("G92 %c0\n", extruderCharacter[extruderNr]);
         totalFilament[extruderNr] += extrusionAmount;
         extrusionAmountAtPreviousRetraction -= extrusionAmount;
         extrusionAmount = 0.0;
@@ -212,10 +347,29 @@ void GCodeExport::resetExtrusionValue()
 
 void GCodeExport::writeDelay(double timeAmount)
 {
-    fprintf(f, "G4 P%d\n", int(timeAmount * 1000));
+    writeRaw("G4 P%d\n", int(timeAmount * 1000));
+    flushPrintTimeEstimate();
     totalPrintTime += timeAmount;
 }
 
+void GCodeExport::writePrime()
+{
+    if (retractionZHop > 0)
+        writeRaw("G1 Z%0.3f\n", float(currentPosition.z)/1000);
+    if (flavor == GCODE_FLAVOR_ULTIGCODE || flavor == GCODE_FLAVOR_REPRAP_VOLUMATRIC)
+    {
+        writeRaw("G11\n");
+    }else{
+        extrusionAmount += retractionAmountPrime;
+        writeRaw("G1 F%i %c%0.5f\n", retractionSpeed * 60, extruderCharacter[extruderNr], extrusionAmount);
+        currentSpeed = retractionSpeed;
+        estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusionAmount), currentSpeed);
+    }
+    if (extrusionAmount > 10000.0) //According to https://github.com/Ultimaker/CuraEngine/issues/14 having more then 21m of extrusion causes inaccuracies. So reset it every 10m, just to be sure.
+        resetExtrusionValue();
+    isRetracted = false;
+}
+
 void GCodeExport::writeMove(Point p, int speed, int lineWidth)
 {
     if (currentPosition.x == p.X && currentPosition.y == p.Y && currentPosition.z == zPos)
@@ -235,10 +389,10 @@ void GCodeExport::writeMove(Point p, int speed, int lineWidth)
                 if (currentSpeed != int(rpm * 10))
                 {
                     //fprintf(f, "; %f e-per-mm %d mm-width %d mm/s\n", extrusionPerMM, lineWidth, speed);
-                    fprintf(f, "M108 S%0.1f\r\n", rpm);
+                    writeRaw("M108 S%0.1f\r\n", rpm);
                     currentSpeed = int(rpm * 10);
                 }
-                fprintf(f, "M%d01\r\n", extruderNr + 1);
+                writeRaw("M%d01\r\n", extruderNr + 1);
                 isRetracted = false;
             }
             //Fix the speed by the actual RPM we are asking, because of rounding errors we cannot get all RPM values, but we have a lot more resolution in the feedrate value.
@@ -252,11 +406,11 @@ void GCodeExport::writeMove(Point p, int speed, int lineWidth)
             //If we are not extruding, check if we still need to disable the extruder. This causes a retraction due to auto-retraction.
             if (!isRetracted)
             {
-                fprintf(f, "M103\r\n");
+                writeRaw("M103\r\n");
                 isRetracted = true;
             }
         }
-        fprintf(f, "G1 X%0.3f Y%0.3f Z%0.3f F%0.1f\r\n", INT2MM(p.X - extruderOffset[extruderNr].X), INT2MM(p.Y - extruderOffset[extruderNr].Y), INT2MM(zPos), fspeed);
+        writeRaw("G1 X%0.3f Y%0.3f Z%0.3f F%0.1f\r\n", INT2MM(p.X - extruderOffset[extruderNr].X), INT2MM(p.Y - extruderOffset[extruderNr].Y), INT2MM(zPos), fspeed);
     }else{
         
         //Normal E handling.
@@ -264,40 +418,25 @@ void GCodeExport::writeMove(Point p, int speed, int lineWidth)
         {
             Point diff = p - getPositionXY();
             if (isRetracted)
-            {
-                if (retractionZHop > 0)
-                    fprintf(f, "G1 Z%0.3f\n", float(currentPosition.z)/1000);
-                if (flavor == GCODE_FLAVOR_ULTIGCODE || flavor == GCODE_FLAVOR_REPRAP_VOLUMATRIC)
-                {
-                    fprintf(f, "G11\n");
-                }else{
-                    extrusionAmount += retractionAmountPrime;
-                    fprintf(f, "G1 F%i %c%0.5f\n", retractionSpeed * 60, extruderCharacter[extruderNr], extrusionAmount);
-                    currentSpeed = retractionSpeed;
-                    estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusionAmount), currentSpeed);
-                }
-                if (extrusionAmount > 10000.0) //According to https://github.com/Ultimaker/CuraEngine/issues/14 having more then 21m of extrusion causes inaccuracies. So reset it every 10m, just to be sure.
-                    resetExtrusionValue();
-                isRetracted = false;
-            }
+                writePrime();
             extrusionAmount += extrusionPerMM * INT2MM(lineWidth) * vSizeMM(diff);
-            fprintf(f, "G1");
+            writeRaw("G1");
         }else{
-            fprintf(f, "G0");
+            writeRaw("G0");
         }
 
         if (currentSpeed != speed)
         {
-            fprintf(f, " F%i", speed * 60);
+            writeRaw(" F%i", speed * 60);
             currentSpeed = speed;
         }
 
-        fprintf(f, " X%0.3f Y%0.3f", INT2MM(p.X - extruderOffset[extruderNr].X), INT2MM(p.Y - extruderOffset[extruderNr].Y));
+        writeRaw(" X%0.3f Y%0.3f", INT2MM(p.X - extruderOffset[extruderNr].X), INT2MM(p.Y - extruderOffset[extruderNr].Y));
         if (zPos != currentPosition.z)
-            fprintf(f, " Z%0.3f", INT2MM(zPos));
+            writeRaw(" Z%0.3f", INT2MM(zPos));
         if (lineWidth != 0)
-            fprintf(f, " %c%0.5f", extruderCharacter[extruderNr], extrusionAmount);
-        fprintf(f, "\n");
+            writeRaw(" %c%0.5f", extruderCharacter[extruderNr], extrusionAmount);
+        writeRaw("\n");
     }
     
     currentPosition = Point3(p.X, p.Y, zPos);
@@ -305,6 +444,57 @@ void GCodeExport::writeMove(Point p, int speed, int lineWidth)
     estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusionAmount), speed);
 }
 
+void GCodeExport::writeArc(Point center, bool clockwise, const Point* points, unsigned int pointCount, int speed, int lineWidth)
+{
+    //Arcs are only written in the XY plane for extrusion moves, anything else falls back to the chords.
+    if (flavor == GCODE_FLAVOR_BFB || lineWidth == 0 || zPos != currentPosition.z || pointCount < 2)
+    {
+        for(unsigned int n=0; n<pointCount; n++)
+            writeMove(points[n], speed, lineWidth);
+        return;
+    }
+    if (isRetracted)
+        writePrime();
+
+    Point start = getPositionXY();
+    Point end = points[pointCount - 1];
+    double chordLength = 0.0;
+    Point p0 = start;
+    for(unsigned int n=0; n<pointCount; n++)
+    {
+        chordLength += vSizeMM(points[n] - p0);
+        p0 = points[n];
+    }
+    double startAngle = atan2(double(start.Y - center.Y), double(start.X - center.X));
+    double endAngle = atan2(double(end.Y - center.Y), double(end.X - center.X));
+    double sweep = clockwise ? startAngle - endAngle : endAngle - startAngle;
+    if (sweep <= 0.0)
+        sweep += 2.0 * M_PI;
+    double arcLength = vSizeMM(start - center) * sweep;
+
+    //The estimate follows the chords, scaled so the filament adds up to the arc length.
+    double extrusionScale = chordLength > 0.0 ? arcLength / chordLength : 1.0;
+    p0 = start;
+    for(unsigned int n=0; n<pointCount; n++)
+    {
+        extrusionAmount += extrusionPerMM * INT2MM(lineWidth) * vSizeMM(points[n] - p0) * extrusionScale;
+        p0 = points[n];
+        estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(p0.X), INT2MM(p0.Y), INT2MM(zPos), extrusionAmount), speed);
+    }
+
+    writeRaw(clockwise ? "G2" : "G3");
+    if (currentSpeed != speed)
+    {
+        writeRaw(" F%i", speed * 60);
+        currentSpeed = speed;
+    }
+    writeRaw(" X%0.3f Y%0.3f I%0.3f J%0.3f", INT2MM(end.X - extruderOffset[extruderNr].X), INT2MM(end.Y - extruderOffset[extruderNr].Y), INT2MM(center.X - start.X), INT2MM(center.Y - start.Y));
+    writeRaw(" %c%0.5f\n", extruderCharacter[extruderNr], extrusionAmount);
+
+    currentPosition = Point3(end.X, end.Y, zPos);
+    startPosition = currentPosition;
+}
+
 void GCodeExport::writeRetraction(bool force)
 {
     if (flavor == GCODE_FLAVOR_BFB)//BitsFromBytes does automatic retraction.
@@ -314,14 +504,14 @@ void GCodeExport::writeRetraction(bool force)
     {
         if (flavor == GCODE_FLAVOR_ULTIGCODE || flavor == GCODE_FLAVOR_REPRAP_VOLUMATRIC)
         {
-            fprintf(f, "G10\n");
+            writeRaw("G10\n");
         }else{
-            fprintf(f, "G1 F%i %c%0.5f\n", retractionSpeed * 60, extruderCharacter[extruderNr], extrusionAmount - retractionAmount);
+            writeRaw("G1 F%i %c%0.5f\n", retractionSpeed * 60, extruderCharacter[extruderNr], extrusionAmount - retractionAmount);
             currentSpeed = retractionSpeed;
             estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusionAmount - retractionAmount), currentSpeed);
         }
         if (retractionZHop > 0)
-            fprintf(f, "G1 Z%0.3f\n", INT2MM(currentPosition.z + retractionZHop));
+            writeRaw("G1 Z%0.3f\n", INT2MM(currentPosition.z + retractionZHop));
         extrusionAmountAtPreviousRetraction = extrusionAmount;
         isRetracted = true;
     }
@@ -334,7 +524,7 @@ void GCodeExport::switchExtruder(int newExtruder)
     if (flavor == GCODE_FLAVOR_BFB)
     {
         if (!isRetracted)
-            fprintf(f, "M103\r\n");
+            writeRaw("M103\r\n");
         isRetracted = true;
         return;
     }
@@ -342,32 +532,32 @@ void GCodeExport::switchExtruder(int newExtruder)
     resetExtrusionValue();
     if (flavor == GCODE_FLAVOR_ULTIGCODE || flavor == GCODE_FLAVOR_REPRAP_VOLUMATRIC)
     {
-        fprintf(f, "G10 S1\n");
+        writeRaw("G10 S1\n");
     }else{
-        fprintf(f, "G1 F%i %c%0.5f\n", retractionSpeed * 60, extruderCharacter[extruderNr], extrusionAmount - extruderSwitchRetraction);
+        writeRaw("G1 F%i %c%0.5f\n", retractionSpeed * 60, extruderCharacter[extruderNr], extrusionAmount - extruderSwitchRetraction);
         currentSpeed = retractionSpeed;
     }
     if (retractionZHop > 0)
-        fprintf(f, "G1 Z%0.3f\n", INT2MM(currentPosition.z + retractionZHop));
+        writeRaw("G1 Z%0.3f\n", INT2MM(currentPosition.z + retractionZHop));
     extruderNr = newExtruder;
     if (flavor == GCODE_FLAVOR_MACH3)
         resetExtrusionValue();
     isRetracted = true;
     writeCode(preSwitchExtruderCode.c_str());
     if (flavor == GCODE_FLAVOR_MAKERBOT)
-        fprintf(f, "M135 T%i\n", extruderNr);
+        writeRaw("M135 T%i\n", extruderNr);
     else
-        fprintf(f, "T%i\n", extruderNr);
+        writeRaw("T%i\n", extruderNr);
     writeCode(postSwitchExtruderCode.c_str());
 }
 
 void GCodeExport::writeCode(const char* str)
 {
-    fprintf(f, "%s", str);
+    writeRaw("%s", str);
     if (flavor == GCODE_FLAVOR_BFB)
-        fprintf(f, "\r\n");
+        writeRaw("\r\n");
     else
-        fprintf(f, "\n");
+        writeRaw("\n");
 }
 
 void GCodeExport::writeFanCommand(int speed)
@@ -377,29 +567,35 @@ void GCodeExport::writeFanCommand(int speed)
     if (speed > 0)
     {
         if (flavor == GCODE_FLAVOR_MAKERBOT)
-            fprintf(f, "M126 T0 ; value = %d\n", speed * 255 / 100);
+            writeRaw("M126 T0 ; value = %d\n", speed * 255 / 100);
         else if (flavor == GCODE_FLAVOR_MACH3)
-            fprintf(f, "M106 P%d\n", speed * 255 / 100);
+            writeRaw("M106 P%d\n", speed * 255 / 100);
         else
-            fprintf(f, "M106 S%d\n", speed * 255 / 100);
+            writeRaw("M106 S%d\n", speed * 255 / 100);
     }
     else
     {
         if (flavor == GCODE_FLAVOR_MAKERBOT)
-            fprintf(f, "M127 T0\n");
+            writeRaw("M127 T0\n");
         else if (flavor == GCODE_FLAVOR_MACH3)
-            fprintf(f, "M106 P%d\n", 0);
+            writeRaw("M106 P%d\n", 0);
         else
-            fprintf(f, "M107\n");
+            writeRaw("M107\n");
     }
     currentFanSpeed = speed;
 }
 
 int GCodeExport::getFileSize(){
+    if (estimateOnly)
+        return 0;
     return ftell(f);
 }
 void GCodeExport::tellFileSize() {
+    if (estimateOnly)
+        return;
     float fsize = ftell(f);
+    if (fsize < 0)
+        return;
     if(fsize > 1024*1024) {
         fsize /= 1024.0*1024.0;
         cLog("Wrote %5.1f MB.\n",fsize);
@@ -425,12 +621,25 @@ void GCodeExport::finalize(int maxObjectHeight, int moveSpeed, const char* endCo
     {
         char numberString[16];
         sprintf(numberString, "%d", int(getTotalPrintTime()));
-        replaceTagInStart("<__TIME__>", numberString);
+        bool replaced = replaceTagInStart("<__TIME__>", numberString);
         sprintf(numberString, "%d", int(getTotalFilamentUsed(0)));
-        replaceTagInStart("<FILAMENT>", numberString);
+        replaced = replaceTagInStart("<FILAMENT>", numberString) && replaced;
         sprintf(numberString, "%d", int(getTotalFilamentUsed(1)));
-        replaceTagInStart("<FILAMEN2>", numberString);
+        replaced = replaceTagInStart("<FILAMEN2>", numberString) && replaced;
+
+        //When streaming to a pipe or socket the header can not be rewritten, so the totals are added as a trailer.
+        if (!replaced)
+        {
+            writeComment("TIME:%d", int(getTotalPrintTime()));
+            writeComment("MATERIAL:%d", int(getTotalFilamentUsed(0)));
+            writeComment("MATERIAL2:%d", int(getTotalFilamentUsed(1)));
+        }
     }
+    flushStream();
+#ifdef HAVE_ZLIB
+    if (gzip)
+        gzip->flush();
+#endif
 }
 
 GCodePath* GCodePlanner::getLatestPathWithConfig(GCodePathConfig* config)
@@ -462,6 +671,7 @@ GCodePlanner::GCodePlanner(GCodeExport& gcode, int travelSpeed, int retractionMi
     totalPrintTime = 0.0;
     forceRetraction = false;
     alwaysRetract = false;
+    pathOrderCache = nullptr;
     currentExtruder = gcode.getExtruderNr();
     this->retractionMinimalDistance = retractionMinimalDistance;
 }
@@ -542,7 +752,7 @@ void GCodePlanner::addPolygon(PolygonRef polygon, int startIdx, GCodePathConfig*
 
 void GCodePlanner::addPolygonsByOptimizer(Polygons& polygons, GCodePathConfig* config)
 {
-    PathOrderOptimizer orderOptimizer(lastPosition);
+    PathOrderOptimizer orderOptimizer(lastPosition, pathOrderCache);
     for(unsigned int i=0;i<polygons.size();i++)
         orderOptimizer.addPolygon(polygons[i]);
     orderOptimizer.optimize();
@@ -605,10 +815,86 @@ void GCodePlanner::forceMinimalLayerTime(double minTime, int minimalSpeed)
     }
 }
 
+//Fit a circle through start, the middle and the last point. The fit holds when every point lies within tolerance of the circle,
+// every chord stays within tolerance of the arc and the path keeps turning in the same direction for less than a full circle.
+static bool fitArc(Point start, const Point* points, unsigned int count, int tolerance, Point& center, bool& clockwise)
+{
+    Point mid = points[(count - 1) / 2] - start;
+    Point end = points[count - 1] - start;
+    double bx = mid.X, by = mid.Y;
+    double cx = end.X, cy = end.Y;
+    double d = 2.0 * (bx * cy - by * cx);
+    if (fabs(d) < 1.0)
+        return false;
+    double b2 = bx * bx + by * by;
+    double c2 = cx * cx + cy * cy;
+    double ux = (cy * b2 - by * c2) / d;
+    double uy = (bx * c2 - cx * b2) / d;
+    double radius = sqrt(ux * ux + uy * uy);
+    if (radius > ARC_FIT_MAX_RADIUS)
+        return false;
+    double centerX = start.X + ux;
+    double centerY = start.Y + uy;
+    clockwise = d < 0.0;
+
+    double sweep = 0.0;
+    double x0 = start.X - centerX, y0 = start.Y - centerY;
+    for(unsigned int n=0; n<count; n++)
+    {
+        double x1 = points[n].X - centerX, y1 = points[n].Y - centerY;
+        if (fabs(sqrt(x1 * x1 + y1 * y1) - radius) > tolerance)
+            return false;
+        double cross = x0 * y1 - y0 * x1;
+        if (cross == 0.0 || (cross < 0.0) != clockwise)
+            return false;
+        double halfChord = sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0)) / 2.0;
+        if (halfChord >= radius || radius - sqrt(radius * radius - halfChord * halfChord) > tolerance)
+            return false;
+        sweep += fabs(atan2(cross, x0 * x1 + y0 * y1));
+        x0 = x1;
+        y0 = y1;
+    }
+    if (sweep >= 2.0 * M_PI - 0.01)
+        return false;
+    center = Point(int64_t(centerX + 0.5), int64_t(centerY + 0.5));
+    return true;
+}
+
+void GCodePlanner::writeArcFittedPath(GCodePath* path, int speed, int tolerance)
+{
+    vector<Point>& points = path->points;
+    unsigned int n = 0;
+    while(n < points.size())
+    {
+        //Grow the arc one point at a time for as long as it still fits.
+        Point start = gcode.getPositionXY();
+        Point center, bestCenter;
+        bool clockwise, bestClockwise = false;
+        unsigned int bestEnd = 0;
+        for(unsigned int end = n + ARC_FIT_MIN_SEGMENTS; end <= points.size() && end - n <= ARC_FIT_MAX_SEGMENTS; end++)
+        {
+            if (!fitArc(start, &points[n], end - n, tolerance, center, clockwise))
+                break;
+            bestEnd = end;
+            bestCenter = center;
+            bestClockwise = clockwise;
+        }
+        if (bestEnd > 0)
+        {
+            gcode.writeArc(bestCenter, bestClockwise, &points[n], bestEnd - n, speed, path->config->lineWidth);
+            n = bestEnd;
+        }else{
+            gcode.writeMove(points[n], speed, path->config->lineWidth);
+            n++;
+        }
+    }
+}
+
 void GCodePlanner::writeGCode(bool liftHeadIfNeeded, int layerThickness)
 {
     GCodePathConfig* lastConfig = nullptr;
     int extruder = gcode.getExtruderNr();
+    int arcFittingTolerance = gcode.getArcFittingTolerance();
 
     for(unsigned int n=0; n<paths.size(); n++)
     {
@@ -697,6 +983,9 @@ void GCodePlanner::writeGCode(bool liftHeadIfNeeded, int layerThickness)
                 gcode.setZ(z + layerThickness * length / totalLength);
                 gcode.writeMove(path->points[i], speed, path->config->lineWidth);
             }
+        }else if (arcFittingTolerance > 0 && path->config->lineWidth != 0)
+        {
+            writeArcFittedPath(path, speed, arcFittingTolerance);
         }else{
             for(unsigned int i=0; i<path->points.size(); i++)
             {
@@ -3,15 +3,28 @@
 #define GCODEEXPORT_H
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <vector>
 
 #include "settings.h"
 #include "comb.h"
 #include "utils/intpoint.h"
 #include "utils/polygon.h"
 #include "timeEstimate.h"
+#include "utils/gzipStream.h"
+#include "pathOrderOptimizer.h"
 
 namespace cura {
 
+//Number of layers that are collected before their print time is estimated together.
+#define PRINT_TIME_ESTIMATE_BATCH_SIZE 64
+
+//Arcs are only fitted on at least this many path segments, and a single arc covers at most ARC_FIT_MAX_SEGMENTS.
+#define ARC_FIT_MIN_SEGMENTS 4
+#define ARC_FIT_MAX_SEGMENTS 128
+//Nearly straight runs fit huge circles, which are written as normal moves instead.
+#define ARC_FIT_MAX_RADIUS MM2INT(500.0)
+
 //The GCodeExport class writes the actual GCode. This is the only class that knows how GCode looks and feels.
 //  Any customizations on GCodes flavors are done in this class.
 class GCodeExport
@@ -36,29 +49,57 @@ private:
     int extruderNr;
     int currentFanSpeed;
     int flavor;
+    int arcFittingTolerance;
     std::string preSwitchExtruderCode;
     std::string postSwitchExtruderCode;
     
     double totalFilament[MAX_EXTRUDERS];
     double totalPrintTime;
     TimeEstimateCalculator estimateCalculator;
+    bool estimateOnly;
+    bool seekable;
+    GzipStream* gzip;
+    std::vector<char> formatBuffer;
+
+    void updateSeekable();
+    void writePrime();
+
+    //All G-code text goes through writeRaw, which discards it in estimate only mode.
+    void writeRaw(const char* format, ...);
+    void writeRawV(const char* format, va_list args);
 public:
     
     GCodeExport();
     
     ~GCodeExport();
     
-    void replaceTagInStart(const char* tag, const char* replaceValue);
+    //Rewrite a fixed width placeholder in the header, returns false when the output can not be rewritten.
+    bool replaceTagInStart(const char* tag, const char* replaceValue);
     
     void setExtruderOffset(int id, Point p);
     void setSwitchExtruderCode(std::string preSwitchExtruderCode, std::string postSwitchExtruderCode);
     
     void setFlavor(int flavor);
     int getFlavor();
+
+    //Arcs are opt-in, the tolerance is 0 when disabled or when the flavor has no G2/G3 support.
+    void setArcFittingTolerance(int tolerance);
+    int getArcFittingTolerance();
     
     void setFilename(const char* filename);
+    void setFile(FILE* file);
+    //Compress the written G-code with gzip, the header totals are then written as a trailer. Returns false without zlib support.
+    bool enableCompression();
+    //Pipes and sockets are not seekable, the G-code is then streamed and the header totals are written as a trailer.
+    bool isSeekable();
+    //Flush the written G-code when streaming, so the receiver gets every layer as soon as it is finished.
+    void flushStream();
     
     bool isOpened();
+
+    //In estimate only mode moves are still fed into the print time estimate and filament counters, but no G-code is formatted or written.
+    void setEstimateOnly(bool estimateOnly);
+    bool isEstimateOnly();
     
     void setExtrusion(int layerThickness, int filamentDiameter, int flow);
     
@@ -82,6 +123,7 @@ public:
 
     double getTotalPrintTime();
     void updateTotalPrintTime();
+    void flushPrintTimeEstimate();
     
     void writeComment(const char* comment, ...);
 
@@ -92,6 +134,9 @@ public:
     void writeDelay(double timeAmount);
     
     void writeMove(Point p, int speed, int lineWidth);
+
+    //Write the path points as a single G2/G3 arc around center ending at the last point. The points are the original chords, which feed the print time estimate.
+    void writeArc(Point center, bool clockwise, const Point* points, unsigned int pointCount, int speed, int lineWidth);
     
     void writeRetraction(bool force=false);
     
@@ -158,9 +203,11 @@ private:
     bool alwaysRetract;
     double extraTime;
     double totalPrintTime;
+    PathOrderCache* pathOrderCache;
 private:
     GCodePath* getLatestPathWithConfig(GCodePathConfig* config);
     void forceNewPathStart();
+    void writeArcFittedPath(GCodePath* path, int speed, int tolerance);
 public:
     GCodePlanner(GCodeExport& gcode, int travelSpeed, int retractionMinimalDistance);
     ~GCodePlanner();
@@ -192,6 +239,11 @@ public:
     {
         this->alwaysRetract = alwaysRetract;
     }
+
+    void setPathOrderCache(PathOrderCache* pathOrderCache)
+    {
+        this->pathOrderCache = pathOrderCache;
+    }
     
     void forceRetract()
     {
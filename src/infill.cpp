@@ -1,5 +1,8 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#include <algorithm>
+
 #include "infill.h"
+#include "settings.h"
 
 namespace cura {
 
@@ -42,17 +45,29 @@ void generateGridInfill(const Polygons& in_outline, Polygons& result,
                        infillOverlap, rotation + 90);
 }
 
-int compare_int64_t(const void* a, const void* b)
+//Sort the crossings of a single scanline. Scanlines mostly cross only a few edges, so insertion sort beats a generic sort here.
+static void sortScanlineCuts(int64_t* cuts, unsigned int count)
 {
-    int64_t n = (*(int64_t*)a) - (*(int64_t*)b);
-    if (n < 0) return -1;
-    if (n > 0) return 1;
-    return 0;
+    if (count > 16)
+    {
+        std::sort(cuts, cuts + count);
+        return;
+    }
+    for(unsigned int i = 1; i < count; i++)
+    {
+        int64_t value = cuts[i];
+        unsigned int j = i;
+        for(; j > 0 && cuts[j - 1] > value; j--)
+            cuts[j] = cuts[j - 1];
+        cuts[j] = value;
+    }
 }
 
 void generateLineInfill(const Polygons& in_outline, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation)
 {
     Polygons outline = in_outline.offset(extrusionWidth * infillOverlap / 100);
+    if (outline.size() < 1)
+        return;
     PointMatrix matrix(rotation);
     
     outline.applyMatrix(matrix);
@@ -61,47 +76,157 @@ void generateLineInfill(const Polygons& in_outline, Polygons& result, int extrus
     
     boundary.min.X = ((boundary.min.X / lineSpacing) - 1) * lineSpacing;
     int lineCount = (boundary.max.X - boundary.min.X + (lineSpacing - 1)) / lineSpacing;
-    vector<vector<int64_t> > cutList;
-    for(int n=0; n<lineCount; n++)
-        cutList.push_back(vector<int64_t>());
+    if (lineCount < 1)
+        return;
+    const int64_t firstLineX = boundary.min.X + lineSpacing / 2;
 
+    //Build the edge table. Every edge that crosses at least one scanline is stored with the range of scanlines [edgeFirstLine, edgeEndLine) it crosses.
+    // The edges are kept as flat arrays so the crossing calculation below is a tight loop over plain integers.
+    vector<int64_t> edgeX0, edgeY0, edgeDX, edgeDY;
+    vector<int> edgeFirstLine, edgeEndLine;
+    vector<int> lineEdgeCount(lineCount + 1, 0);
     for(unsigned int polyNr=0; polyNr < outline.size(); polyNr++)
     {
-        Point p1 = outline[polyNr][outline[polyNr].size()-1];
-        for(unsigned int i=0; i < outline[polyNr].size(); i++)
+        PolygonRef poly = outline[polyNr];
+        Point p1 = poly[poly.size()-1];
+        for(unsigned int i=0; i < poly.size(); i++)
         {
-            Point p0 = outline[polyNr][i];
-            int idx0 = (p0.X - boundary.min.X) / lineSpacing;
-            int idx1 = (p1.X - boundary.min.X) / lineSpacing;
-            int64_t xMin = p0.X, xMax = p1.X;
-            if (p0.X > p1.X) { xMin = p1.X; xMax = p0.X; }
-            if (idx0 > idx1) { int tmp = idx0; idx0 = idx1; idx1 = tmp; }
-            for(int idx = idx0; idx<=idx1; idx++)
+            Point p0 = poly[i];
+            int64_t xMin = std::min(p0.X, p1.X);
+            int64_t xMax = std::max(p0.X, p1.X);
+            //The scanlines crossed are the ones with xMin <= x < xMax.
+            int firstLine = (xMin - boundary.min.X) / lineSpacing;
+            if (firstLine * lineSpacing + firstLineX < xMin)
+                firstLine++;
+            int endLine = (xMax - boundary.min.X) / lineSpacing;
+            if (endLine * lineSpacing + firstLineX < xMax)
+                endLine++;
+            endLine = std::min(endLine, lineCount);
+            if (firstLine < endLine)
             {
-                int x = (idx * lineSpacing) + boundary.min.X + lineSpacing / 2;
-                if (x < xMin) continue;
-                if (x >= xMax) continue;
-                int y = p0.Y + (p1.Y - p0.Y) * (x - p0.X) / (p1.X - p0.X);
-                cutList[idx].push_back(y);
+                edgeX0.push_back(p0.X);
+                edgeY0.push_back(p0.Y);
+                edgeDX.push_back(p1.X - p0.X);
+                edgeDY.push_back(p1.Y - p0.Y);
+                edgeFirstLine.push_back(firstLine);
+                edgeEndLine.push_back(endLine);
+                lineEdgeCount[firstLine + 1]++;
             }
             p1 = p0;
         }
     }
-    
-    int idx = 0;
-    for(int64_t x = boundary.min.X + lineSpacing / 2; x < boundary.max.X; x += lineSpacing)
+
+    //Bucket the edges on the first scanline they cross, so each scanline can pick up its new edges directly.
+    for(int n=0; n<lineCount; n++)
+        lineEdgeCount[n + 1] += lineEdgeCount[n];
+    vector<int> edgeByLine(edgeX0.size());
     {
-        qsort(cutList[idx].data(), cutList[idx].size(), sizeof(int64_t), compare_int64_t);
-        for(unsigned int i = 0; i + 1 < cutList[idx].size(); i+=2)
+        vector<int> insertIdx(lineEdgeCount.begin(), lineEdgeCount.end() - 1);
+        for(unsigned int e=0; e<edgeX0.size(); e++)
+            edgeByLine[insertIdx[edgeFirstLine[e]]++] = e;
+    }
+
+    vector<int> activeEdges;
+    vector<int64_t> cuts;
+    for(int idx=0; idx<lineCount; idx++)
+    {
+        int64_t x = firstLineX + int64_t(idx) * lineSpacing;
+
+        //Update the active edge list, drop the edges that ended and add the ones that start at this scanline.
+        unsigned int activeCount = 0;
+        for(unsigned int n=0; n<activeEdges.size(); n++)
+        {
+            if (edgeEndLine[activeEdges[n]] > idx)
+                activeEdges[activeCount++] = activeEdges[n];
+        }
+        activeEdges.resize(activeCount);
+        for(int n=lineEdgeCount[idx]; n<lineEdgeCount[idx + 1]; n++)
+            activeEdges.push_back(edgeByLine[n]);
+        if (activeEdges.size() < 2)
+            continue;
+
+        cuts.resize(activeEdges.size());
+        for(unsigned int n=0; n<activeEdges.size(); n++)
+        {
+            int e = activeEdges[n];
+            cuts[n] = edgeY0[e] + edgeDY[e] * (x - edgeX0[e]) / edgeDX[e];
+        }
+        sortScanlineCuts(cuts.data(), cuts.size());
+
+        for(unsigned int i = 0; i + 1 < cuts.size(); i+=2)
         {
-            if (cutList[idx][i+1] - cutList[idx][i] < extrusionWidth / 5)
+            if (cuts[i+1] - cuts[i] < extrusionWidth / 5)
                 continue;
             PolygonRef p = result.newPoly();
-            p.add(matrix.unapply(Point(x, cutList[idx][i])));
-            p.add(matrix.unapply(Point(x, cutList[idx][i+1])));
+            p.add(matrix.unapply(Point(x, cuts[i])));
+            p.add(matrix.unapply(Point(x, cuts[i+1])));
         }
-        idx += 1;
     }
 }
 
+InfillCache::InfillCache(unsigned int maxEntries)
+: maxEntries(maxEntries), nextEntry(0)
+{
+}
+
+void InfillCache::generate(const Polygons& outline, Polygons& result, int pattern, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation)
+{
+    uint64_t hash = outline.hash();
+    for(unsigned int n=0; n<entries.size(); n++)
+    {
+        Entry& e = entries[n];
+        if (e.hash == hash && e.pattern == pattern && e.extrusionWidth == extrusionWidth && e.lineSpacing == lineSpacing
+            && e.infillOverlap == infillOverlap && e.rotation == rotation && e.outline == outline)
+        {
+            result.add(e.result);
+            return;
+        }
+    }
+
+    Polygons infill;
+    switch(pattern)
+    {
+    case INFILL_AUTOMATIC:
+        generateAutomaticInfill(outline, infill, extrusionWidth, lineSpacing, infillOverlap, rotation);
+        break;
+    case INFILL_GRID:
+        generateGridInfill(outline, infill, extrusionWidth, lineSpacing, infillOverlap, rotation);
+        break;
+    case INFILL_LINES:
+        generateLineInfill(outline, infill, extrusionWidth, lineSpacing, infillOverlap, rotation);
+        break;
+    case INFILL_CONCENTRIC:
+        generateConcentricInfill(outline, infill, lineSpacing);
+        break;
+    }
+    result.add(infill);
+
+    if (maxEntries < 1)
+        return;
+    unsigned int slot;
+    if (entries.size() < maxEntries)
+    {
+        slot = entries.size();
+        entries.push_back(Entry());
+    }else{
+        slot = nextEntry;
+        nextEntry = (nextEntry + 1) % maxEntries;
+    }
+    Entry& e = entries[slot];
+    e.hash = hash;
+    e.outline = outline;
+    e.pattern = pattern;
+    e.extrusionWidth = extrusionWidth;
+    e.lineSpacing = lineSpacing;
+    e.infillOverlap = infillOverlap;
+    e.rotation = rotation;
+    e.result = infill;
+}
+
+void InfillCache::clear()
+{
+    entries.clear();
+    nextEntry = 0;
+}
+
 }//namespace cura
@@ -11,6 +11,38 @@ void generateAutomaticInfill(const Polygons& in_outline, Polygons& result, int e
 void generateGridInfill(const Polygons& in_outline, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
 void generateLineInfill(const Polygons& in_outline, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
 
+/**
+ * Cache for generated infill. Layers in the middle of a part often have the exact same sparse outline and only alternate the fill angle,
+ * so the infill for an outline is kept, keyed on the outline and all the settings that influence the pattern.
+ * The cache holds a limited amount of entries, the oldest entry is replaced when it is full.
+ */
+class InfillCache
+{
+private:
+    class Entry
+    {
+    public:
+        uint64_t hash;
+        Polygons outline;
+        int pattern;
+        int extrusionWidth;
+        int lineSpacing;
+        int infillOverlap;
+        double rotation;
+        Polygons result;
+    };
+    vector<Entry> entries;
+    unsigned int maxEntries;
+    unsigned int nextEntry;
+public:
+    InfillCache(unsigned int maxEntries = 128);
+
+    //Add the infill of the given pattern (one of Infill_Pattern) to the result, from the cache if this infill has been generated before.
+    void generate(const Polygons& outline, Polygons& result, int pattern, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
+
+    void clear();
+};
+
 }//namespace cura
 
 #endif//INFILL_H
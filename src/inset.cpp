@@ -4,11 +4,37 @@
 
 namespace cura {
 
-void generateInsets(SliceLayerPart* part, int offset, int insetCount)
+//Offsetting the previous inset gives the same result as offsetting the outline by the total distance, as long as every corner is a plain miter.
+// Corners turning more then 120 degrees exceed the miter limit of 2 and get squared off, which does not add up over multiple offsets.
+static bool offsetIsIncremental(Polygons& polys)
 {
-    part->combBoundery = part->outline.offset(-offset);
+    for(unsigned int n=0; n<polys.size(); n++)
+    {
+        PolygonRef poly = polys[n];
+        if (poly.size() < 3)
+            continue;
+        Point p0 = poly[poly.size() - 2];
+        Point p1 = poly[poly.size() - 1];
+        for(unsigned int i=0; i<poly.size(); i++)
+        {
+            Point p2 = poly[i];
+            Point d0 = p1 - p0;
+            Point d1 = p2 - p1;
+            if (2.0 * double(dot(d0, d1)) < -double(vSize(d0)) * double(vSize(d1)))
+                return false;
+            p0 = p1;
+            p1 = p2;
+        }
+    }
+    return true;
+}
+
+void generateInsets(SliceLayerPart* part, int offset, int insetCount, int simplifyTolerance)
+{
+    bool incremental = offsetIsIncremental(part->outline);
     if (insetCount == 0)
     {
+        part->combBoundery = part->outline.offset(-offset);
         part->insets.push_back(part->outline);
         return;
     }
@@ -16,8 +42,21 @@ void generateInsets(SliceLayerPart* part, int offset, int insetCount)
     for(int i=0; i<insetCount; i++)
     {
         part->insets.push_back(Polygons());
-        part->insets[i] = part->outline.offset(-offset * i - offset/2);
-        optimizePolygons(part->insets[i]);
+        if (i > 0 && incremental)
+            part->insets[i] = part->insets[i-1].offset(-offset);
+        else
+            part->insets[i] = part->outline.offset(-offset * i - offset/2);
+        optimizePolygons(part->insets[i], simplifyTolerance);
+        //Offsets can create new corners where edges collapse, so every inset is checked again before it is used as the next base.
+        incremental = incremental && offsetIsIncremental(part->insets[i]);
+        if (i == 0)
+        {
+            //The comb boundary lies halfway the first inset and the second.
+            if (incremental)
+                part->combBoundery = part->insets[0].offset(-offset/2);
+            else
+                part->combBoundery = part->outline.offset(-offset);
+        }
         if (part->insets[i].size() < 1)
         {
             part->insets.pop_back();
@@ -26,11 +65,33 @@ void generateInsets(SliceLayerPart* part, int offset, int insetCount)
     }
 }
 
-void generateInsets(SliceLayer* layer, int offset, int insetCount)
+void generateInsets(SliceLayer* layer, int offset, int insetCount, int simplifyTolerance, SliceLayer* previousLayer)
 {
     for(unsigned int partNr = 0; partNr < layer->parts.size(); partNr++)
     {
-        generateInsets(&layer->parts[partNr], offset, insetCount);
+        SliceLayerPart* part = &layer->parts[partNr];
+        part->outlineHash = part->outline.hash();
+        SliceLayerPart* identical = nullptr;
+        if (previousLayer)
+        {
+            for(unsigned int n = 0; n < previousLayer->parts.size() && !identical; n++)
+            {
+                SliceLayerPart* previous = &previousLayer->parts[n];
+                if (previous->outlineHash == part->outlineHash && previous->outline == part->outline)
+                    identical = previous;
+            }
+        }
+        if (identical)
+        {
+            part->combBoundery = identical->combBoundery;
+            part->insets = identical->insets;
+            part->fingerprint = identical->fingerprint;
+            continue;
+        }
+        generateInsets(part, offset, insetCount, simplifyTolerance);
+        part->fingerprint = part->outlineHash;
+        for(unsigned int n = 0; n < part->insets.size(); n++)
+            part->fingerprint = hashCombine(part->fingerprint, part->insets[n].hash());
     }
     
     //Remove the parts which did not generate an inset. As these parts are too small to print,
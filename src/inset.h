@@ -6,9 +6,10 @@
 
 namespace cura {
 
-void generateInsets(SliceLayerPart* part, int offset, int insetCount);
+void generateInsets(SliceLayerPart* part, int offset, int insetCount, int simplifyTolerance);
 
-void generateInsets(SliceLayer* layer, int offset, int insetCount);
+//The previous layer, when given, must have been generated with the same settings. Parts with the same outline as a part in that layer copy its insets.
+void generateInsets(SliceLayer* layer, int offset, int insetCount, int simplifyTolerance, SliceLayer* previousLayer);
 
 }//namespace cura
 
@@ -33,7 +33,11 @@
 #include "comb.h"
 #include "gcodeExport.h"
 #include "polygonHelper.h"
+#include "modelInstances.h"
+#include "extruderPlan.h"
+#include "bandSlicer.h"
 #include "fffProcessor.h"
+#include "sliceServer.h"
 
 #ifdef USE_G3LOG
 #include "g3log/g3log.hpp"
@@ -50,7 +54,7 @@ using namespace cura;
 
 void print_usage()
 {
-    cLogError("usage: CuraEngine [-h] [-v] [-m 3x3matrix] [-c <config file>] [-s <settingkey>=<value>] -o <output.gcode> <model.stl>\n");
+    cLogError("usage: CuraEngine [-h] [-v] [-m 3x3matrix] [-c <config file>] [-s <settingkey>=<value>] [-e] [-l <port>] -o <output.gcode> <model.stl>\n");
 }
 
 //Signal handler for a "floating point exception", which can also be integer division by zero errors.
@@ -86,6 +90,7 @@ int main(int argc, char **argv)
     ConfigSettings config;
     fffProcessor processor(config);
     std::vector<std::string> files;
+    bool estimateOnly = false;
 
     cLogError("Cura_SteamEngine version %s\n", VERSION);
     cLogError("Copyright (C) 2014 David Braam\n");
@@ -132,12 +137,25 @@ int main(int argc, char **argv)
                     //Connect the GUI socket to the given port number.
                     processor.guiConnect(atoi(argv[argn]));
                     break;
+                case 'e':
+                    //Only estimate the print time, filament usage and layer count, the result is written to stdout.
+                    estimateOnly = true;
+                    processor.setEstimateOnly();
+                    break;
+                case 'l':
+                    {
+                        //Keep running and slice the jobs sent to the given local port, the settings given so far are the defaults of every job.
+                        argn++;
+                        SliceServer server(config);
+                        return server.run(atoi(argv[argn])) ? 0 : 1;
+                    }
                 case 'b':
                     argn++;
                     //The binaryMeshBlob is depricated and will be removed in the future.
                     binaryMeshBlob = fopen(argv[argn], "rb");
                     break;
                 case 'o':
+                    //Output file, "-" streams the G-code to stdout.
                     argn++;
                     if (!processor.setTargetFile(argv[argn]))
                     {
@@ -222,5 +240,17 @@ int main(int argc, char **argv)
     }
     //Finalize the processor, this adds the end.gcode. And reports statistics.
     processor.finalize();
+    if (estimateOnly)
+    {
+        PrintResult result = processor.getPrintResult();
+        printf("{\"print_time\": %d, \"layer_count\": %d, \"filament\": [", int(result.printTime), result.layerCount);
+        //Only report up to the last extruder that is used.
+        unsigned int extruderCount = MAX_EXTRUDERS;
+        while(extruderCount > 1 && result.filamentUsed[extruderCount - 1] == 0.0)
+            extruderCount--;
+        for(unsigned int e=0; e<extruderCount; e++)
+            printf("%s%0.2f", e > 0 ? ", " : "", result.filamentUsed[e]);
+        printf("]}\n");
+    }
     return 0;
 }
@@ -2,6 +2,15 @@
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#ifndef __WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "modelFile.h"
 #include "../utils/logoutput.h"
@@ -29,11 +38,27 @@ void* fgets_(char* ptr, size_t len, FILE* f)
     return nullptr;
 }
 
-SimpleModel* loadModelSTL_ascii(SimpleModel *m,const char* filename, FMatrix3x3& matrix)
+//Counts the faces passed on to another sink, to find out if an ascii STL file held any faces at all.
+class CountingFaceSink : public FaceSink
+{
+public:
+    FaceSink& sink;
+    int64_t faceCount;
+
+    CountingFaceSink(FaceSink& sink) : sink(sink), faceCount(0) {}
+
+    void addFace(Point3& v0, Point3& v1, Point3& v2)
+    {
+        faceCount++;
+        sink.addFace(v0, v1, v2);
+    }
+};
+
+bool readSTL_ascii(const char* filename, FMatrix3x3& matrix, FaceSink& sink)
 {
-    m->volumes.push_back(SimpleVolume());
-    SimpleVolume* vol = &m->volumes[m->volumes.size()-1];
     FILE* f = fopen(filename, "rt");
+    if (f == nullptr)
+        return false;
     char buffer[1024];
     FPoint3 vertex;
     int n = 0;
@@ -53,101 +78,179 @@ SimpleModel* loadModelSTL_ascii(SimpleModel *m,const char* filename, FMatrix3x3&
                 break;
             case 3:
                 v2 = matrix.apply(vertex);
-                vol->addFace(v0, v1, v2);
+                sink.addFace(v0, v1, v2);
                 n = 0;
                 break;
             }
         }
     }
     fclose(f);
-    return m;
+    return true;
 }
 
-SimpleModel* loadModelSTL_binary(SimpleModel *m,const char* filename, FMatrix3x3& matrix)
+bool readSTL_binary(const char* filename, FMatrix3x3& matrix, FaceSink& sink)
 {
     FILE* f = fopen(filename, "rb");
+    if (f == nullptr)
+        return false;
     char buffer[80];
     uint32_t faceCount;
     //Skip the header
     if (fread(buffer, 80, 1, f) != 1)
     {
         fclose(f);
-        return nullptr;
+        return false;
     }
     //Read the face count
     if (fread(&faceCount, sizeof(uint32_t), 1, f) != 1)
     {
         fclose(f);
-        return nullptr;
+        return false;
     }
     //For each face read:
     //float(x,y,z) = normal, float(X,Y,Z)*3 = vertexes, uint16_t = flags
-    m->volumes.push_back(SimpleVolume());
-    SimpleVolume* vol = &m->volumes[m->volumes.size()-1];
-	if(vol == nullptr)
-	{
-		fclose(f);
-		return nullptr;
-	}
-
     for(unsigned int i=0;i<faceCount;i++)
     {
         if (fread(buffer, sizeof(float) * 3, 1, f) != 1)
         {
             fclose(f);
-            return nullptr;
+            return false;
         }
         float v[9];
         if (fread(v, sizeof(float) * 9, 1, f) != 1)
         {
             fclose(f);
-            return nullptr;
+            return false;
         }
         Point3 v0 = matrix.apply(FPoint3(v[0], v[1], v[2]));
         Point3 v1 = matrix.apply(FPoint3(v[3], v[4], v[5]));
         Point3 v2 = matrix.apply(FPoint3(v[6], v[7], v[8]));
-        vol->addFace(v0, v1, v2);
+        sink.addFace(v0, v1, v2);
         if (fread(buffer, sizeof(uint16_t), 1, f) != 1)
         {
             fclose(f);
-            return nullptr;
+            return false;
         }
     }
     fclose(f);
-    return m;
+    return true;
 }
 
-SimpleModel* loadModelSTL(SimpleModel *m,const char* filename, FMatrix3x3& matrix)
+bool readSTL(const char* filename, FMatrix3x3& matrix, FaceSink& sink)
 {
     FILE* f = fopen(filename, "r");
     char buffer[6];
     if (f == nullptr)
-        return nullptr;
+        return false;
 
     if (fread(buffer, 5, 1, f) != 1)
     {
         fclose(f);
-        return nullptr;
+        return false;
     }
     fclose(f);
 
     buffer[5] = '\0';
     if (stringcasecompare(buffer, "solid") == 0)
     {
-        SimpleModel* asciiModel = loadModelSTL_ascii(m, filename, matrix);
-        if (!asciiModel)
-            return nullptr;
+        CountingFaceSink counter(sink);
+        if (!readSTL_ascii(filename, matrix, counter))
+            return false;
 
         // This logic is used to handle the case where the file starts with
         // "solid" but is a binary file.
-        if (m->volumes[m->volumes.size()-1].faces.size() < 1)
+        if (counter.faceCount < 1)
+            return readSTL_binary(filename, matrix, sink);
+        return true;
+    }
+    return readSTL_binary(filename, matrix, sink);
+}
+
+SimpleModel* loadModelSTL(SimpleModel *m,const char* filename, FMatrix3x3& matrix)
+{
+    m->volumes.push_back(SimpleVolume());
+    if (!readSTL(filename, matrix, m->volumes[m->volumes.size()-1]))
+        return nullptr;
+    return m;
+}
+
+void addFacesFromVertexes(SimpleVolume* volume, const float* vertexes, int vertexCount, FMatrix3x3& matrix)
+{
+    volume->faces.reserve(volume->faces.size() + vertexCount / 3);
+    for(int n=0; n + 2 < vertexCount; n += 3)
+    {
+        const float* f = vertexes + n * 3;
+        Point3 v0 = matrix.apply(FPoint3(f[0], f[1], f[2]));
+        Point3 v1 = matrix.apply(FPoint3(f[3], f[4], f[5]));
+        Point3 v2 = matrix.apply(FPoint3(f[6], f[7], f[8]));
+        volume->addFace(v0, v1, v2);
+    }
+}
+
+SimpleModel* loadModelSharedMemory(SimpleModel* m, const char* name, FMatrix3x3& matrix)
+{
+#ifdef __WIN32
+    (void)m;
+    (void)matrix;
+    cLogError("Shared memory meshes are not supported on this platform: %s\n", name);
+    return nullptr;
+#else
+    int fd;
+    if (strncmp(name, "shm:", 4) == 0)
+        fd = shm_open(name + 4, O_RDONLY, 0);
+    else if (strncmp(name, "fd:", 3) == 0)
+        fd = dup(atoi(name + 3));
+    else
+        return nullptr;
+    if (fd < 0)
+    {
+        cLogError("Failed to open shared memory mesh: %s\n", name);
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size < int(sizeof(int32_t)))
+    {
+        close(fd);
+        return nullptr;
+    }
+    size_t size = info.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        cLogError("Failed to map shared memory mesh: %s\n", name);
+        return nullptr;
+    }
+
+    SimpleModel* ret = m;
+    const char* ptr = static_cast<const char*>(data);
+    const char* end = ptr + size;
+    int32_t volumeCount;
+    memcpy(&volumeCount, ptr, sizeof(int32_t));
+    ptr += sizeof(int32_t);
+    for(int32_t v=0; v<volumeCount && ret; v++)
+    {
+        int32_t vertexCount;
+        if (end - ptr < int(sizeof(int32_t)))
         {
-            m->volumes.erase(m->volumes.end() - 1);
-            return loadModelSTL_binary(m, filename, matrix);
+            ret = nullptr;
+            break;
         }
-        return asciiModel;
+        memcpy(&vertexCount, ptr, sizeof(int32_t));
+        ptr += sizeof(int32_t);
+        if (vertexCount < 0 || size_t(end - ptr) / (sizeof(float) * 3) < size_t(vertexCount))
+        {
+            ret = nullptr;
+            break;
+        }
+        cLog("Reading mesh from shared memory with %i vertexes\n", vertexCount);
+        m->volumes.push_back(SimpleVolume());
+        addFacesFromVertexes(&m->volumes[m->volumes.size()-1], reinterpret_cast<const float*>(ptr), vertexCount, matrix);
+        ptr += size_t(vertexCount) * sizeof(float) * 3;
     }
-    return loadModelSTL_binary(m, filename, matrix);
+    munmap(data, size);
+    return ret;
+#endif
 }
 
 SimpleModel* loadModelFromFile(SimpleModel *m,const char* filename, FMatrix3x3& matrix)
@@ -157,6 +260,10 @@ SimpleModel* loadModelFromFile(SimpleModel *m,const char* filename, FMatrix3x3&
     {
         return loadModelSTL(m,filename, matrix);
     }
+    if (strncmp(filename, "shm:", 4) == 0 || strncmp(filename, "fd:", 3) == 0)
+    {
+        return loadModelSharedMemory(m, filename, matrix);
+    }
     if (filename[0] == '#' && binaryMeshBlob != nullptr)
     {
         while(*filename == '#')
@@ -165,27 +272,42 @@ SimpleModel* loadModelFromFile(SimpleModel *m,const char* filename, FMatrix3x3&
 
             m->volumes.push_back(SimpleVolume());
             SimpleVolume* vol = &m->volumes[m->volumes.size()-1];
-            int32_t n, pNr = 0;
+            int32_t n;
             if (fread(&n, 1, sizeof(int32_t), binaryMeshBlob) < 1)
                 return nullptr;
             cLog("Reading mesh from binary blob with %i vertexes\n", n);
-            Point3 v[3];
-            while(n)
+            std::vector<float> vertexes;
+            while(n > 0)
             {
-                float f[3];
-                if (fread(f, 3, sizeof(float), binaryMeshBlob) < 1)
+                int batch = std::min(n, MESH_VERTEX_BATCH_SIZE);
+                vertexes.resize(batch * 3);
+                if (fread(vertexes.data(), sizeof(float) * 3, batch, binaryMeshBlob) < size_t(batch))
                     return nullptr;
-                FPoint3 fp(f[0], f[1], f[2]);
-                v[pNr++] = matrix.apply(fp);
-                if (pNr == 3)
-                {
-                    vol->addFace(v[0], v[1], v[2]);
-                    pNr = 0;
-                }
-                n--;
+                addFacesFromVertexes(vol, vertexes.data(), batch, matrix);
+                n -= batch;
             }
         }
         return m;
     }
     return nullptr;
 }
+
+bool streamModelFromFile(const char* filename, FMatrix3x3& matrix, FaceSink& sink)
+{
+    const char* ext = strrchr(filename, '.');
+    if (ext && stringcasecompare(ext, ".stl") == 0)
+        return readSTL(filename, matrix, sink);
+
+    SimpleModel model;
+    if (loadModelFromFile(&model, filename, matrix) == nullptr)
+        return false;
+    for(unsigned int v=0; v<model.volumes.size(); v++)
+    {
+        for(unsigned int i=0; i<model.volumes[v].faces.size(); i++)
+        {
+            SimpleFace& face = model.volumes[v].faces[i];
+            sink.addFace(face.v[0], face.v[1], face.v[2]);
+        }
+    }
+    return true;
+}
@@ -27,8 +27,16 @@ public:
     SimpleFace(Point3& v0, Point3& v1, Point3& v2) { v[0] = v0; v[1] = v1; v[2] = v2; }
 };
 
+/* A FaceSink receives the faces of a model one by one as they are read, so a model can be processed without holding all of it in memory. */
+class FaceSink
+{
+public:
+    virtual ~FaceSink() {}
+    virtual void addFace(Point3& v0, Point3& v1, Point3& v2) = 0;
+};
+
 /* A SimpleVolume is the most basic reprisentation of a 3D model. It contains all the faces as SimpleTriangles, with nothing fancy. */
-class SimpleVolume
+class SimpleVolume : public FaceSink
 {
 public:
     vector<SimpleFace> faces;
@@ -114,6 +122,25 @@ public:
     }
 };
 
+//Number of vertexes read at once from a socket or the binary mesh blob. A multiple of 3, so faces are never split between batches.
+#define MESH_VERTEX_BATCH_SIZE (3 * 16384)
+
+//Add the faces of a buffer of vertexCount * 3 floats to the volume, every 3 vertexes are a face.
+void addFacesFromVertexes(SimpleVolume* volume, const float* vertexes, int vertexCount, FMatrix3x3& matrix);
+
+/*
+    Load the volumes from shared memory ("shm:<name>", a POSIX shared memory object) or from an inherited file descriptor
+    ("fd:<number>", for example a memfd). The memory is mapped and read in place, it contains an int32 volume count
+    followed by every volume as an int32 vertex count and vertexCount * 3 floats.
+*/
+SimpleModel* loadModelSharedMemory(SimpleModel* m, const char* name, FMatrix3x3& matrix);
+
 SimpleModel* loadModelFromFile(SimpleModel*m,const char* filename, FMatrix3x3& matrix);
 
+/*
+    Read the faces of a single volume model file into the sink, without storing them. Only STL files are read as a stream,
+    other inputs are loaded in memory first. Returns false when the file cannot be read.
+*/
+bool streamModelFromFile(const char* filename, FMatrix3x3& matrix, FaceSink& sink);
+
 #endif//MODELFILE_H
@@ -0,0 +1,319 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "modelInstances.h"
+
+#define ARRANGE_CELL_SIZE MM2INT(1.0)
+#define ARRANGE_ROTATIONS 4
+
+namespace cura {
+
+bool parseModelInstances(const char* str, vector<ModelInstance>& instances)
+{
+    instances.clear();
+    while(*str)
+    {
+        while(*str == ';' || *str == ' ')
+            str++;
+        if (!*str)
+            break;
+        char* end;
+        double values[3] = {0, 0, 0};
+        int count = 0;
+        while(count < 3)
+        {
+            values[count] = strtod(str, &end);
+            if (end == str)
+                return false;
+            count++;
+            str = end;
+            while(*str == ' ')
+                str++;
+            if (*str != ',')
+                break;
+            str++;
+        }
+        if (count < 2 || (*str && *str != ';'))
+            return false;
+        instances.push_back(ModelInstance(Point(values[0], values[1]), values[2]));
+    }
+    return true;
+}
+
+Point transformPoint(Point p, const PointMatrix& matrix, const ModelInstance& instance, Point center)
+{
+    if (instance.rotation != 0.0)
+        p = matrix.apply(p - center) + center;
+    return p + instance.offset;
+}
+
+void transformPolygons(Polygons& polys, const ModelInstance& instance, Point center)
+{
+    PointMatrix matrix(instance.rotation);
+    for(unsigned int n=0; n<polys.size(); n++)
+    {
+        PolygonRef poly = polys[n];
+        for(ClipperLib::Path::iterator it = poly.begin(); it != poly.end(); it++)
+            *it = transformPoint(*it, matrix, instance, center);
+    }
+}
+
+//The cells covered by a footprint, as a span [start, end) of cells on every row.
+class ArrangeMask
+{
+public:
+    Point origin;
+    int width, height;
+    vector<int> spanStart;
+    vector<int> spanEnd;
+
+    ArrangeMask(Polygons& polys)
+    {
+        AABB aabb(polys);
+        origin = aabb.min;
+        width = (aabb.max.X - aabb.min.X) / ARRANGE_CELL_SIZE + 1;
+        height = (aabb.max.Y - aabb.min.Y) / ARRANGE_CELL_SIZE + 1;
+        spanStart.resize(height, width);
+        spanEnd.resize(height, 0);
+        //Scan the footprint at the center of each row of cells. The footprint is grown by more then half a cell, so the spans cover every cell the footprint touches.
+        vector<int64_t> cuts;
+        for(int y=0; y<height; y++)
+        {
+            int64_t scanY = origin.Y + int64_t(y) * ARRANGE_CELL_SIZE + ARRANGE_CELL_SIZE / 2;
+            cuts.clear();
+            for(unsigned int n=0; n<polys.size(); n++)
+            {
+                PolygonRef poly = polys[n];
+                Point p0 = poly[poly.size() - 1];
+                for(unsigned int i=0; i<poly.size(); i++)
+                {
+                    Point p1 = poly[i];
+                    if ((p0.Y <= scanY) != (p1.Y <= scanY))
+                        cuts.push_back(p0.X + (p1.X - p0.X) * (scanY - p0.Y) / (p1.Y - p0.Y));
+                    p0 = p1;
+                }
+            }
+            std::sort(cuts.begin(), cuts.end());
+            for(unsigned int i=0; i + 1 < cuts.size(); i+=2)
+            {
+                spanStart[y] = std::min<int>(spanStart[y], (cuts[i] - origin.X) / ARRANGE_CELL_SIZE);
+                spanEnd[y] = std::max<int>(spanEnd[y], (cuts[i + 1] - origin.X) / ARRANGE_CELL_SIZE + 1);
+            }
+        }
+    }
+};
+
+//Occupied cells of the bed, with a running count per row so a span can be checked in constant time.
+class ArrangeGrid
+{
+public:
+    int width, height;
+    vector<int> rowCount;
+
+    ArrangeGrid(int width, int height)
+    : width(width), height(height), rowCount((width + 1) * height, 0)
+    {
+    }
+
+    bool fits(const ArrangeMask& mask, int x, int y) const
+    {
+        if (x + mask.width > width || y + mask.height > height)
+            return false;
+        for(int row=0; row<mask.height; row++)
+        {
+            if (mask.spanStart[row] >= mask.spanEnd[row])
+                continue;
+            const int* count = &rowCount[(y + row) * (width + 1)];
+            if (count[x + mask.spanEnd[row]] != count[x + mask.spanStart[row]])
+                return false;
+        }
+        return true;
+    }
+
+    void place(const ArrangeMask& mask, int x, int y)
+    {
+        for(int row=0; row<mask.height; row++)
+        {
+            int* count = &rowCount[(y + row) * (width + 1)];
+            int previous = count[0];
+            for(int cell=0; cell<width; cell++)
+            {
+                bool occupied = (count[cell + 1] != previous) || (cell >= x + mask.spanStart[row] && cell < x + mask.spanEnd[row]);
+                previous = count[cell + 1];
+                count[cell + 1] = count[cell] + (occupied ? 1 : 0);
+            }
+        }
+    }
+};
+
+int arrangeModelInstances(Polygons& footprint, Point center, Point bedSize, int spacing, int margin, int count, vector<ModelInstance>& instances)
+{
+    instances.clear();
+    if (footprint.size() < 1 || count == 0)
+        return 0;
+    ArrangeGrid grid((bedSize.X - margin * 2) / ARRANGE_CELL_SIZE, (bedSize.Y - margin * 2) / ARRANGE_CELL_SIZE);
+    if (grid.width < 1 || grid.height < 1)
+        return 0;
+
+    vector<ArrangeMask> masks;
+    vector<Polygons> rotated;
+    Polygons grown = footprint.offset(spacing / 2 + ARRANGE_CELL_SIZE * 3 / 4);
+    for(int r=0; r<ARRANGE_ROTATIONS; r++)
+    {
+        ModelInstance rotation(Point(0, 0), 360.0 * r / ARRANGE_ROTATIONS);
+        Polygons polys = grown;
+        transformPolygons(polys, rotation, center);
+        masks.push_back(ArrangeMask(polys));
+        polys = footprint;
+        transformPolygons(polys, rotation, center);
+        rotated.push_back(polys);
+    }
+
+    //Bottom left first fit: every copy goes in the lowest row, and then the leftmost cell, where one of the rotations fits.
+    Polygons placed;
+    while(count < 0 || static_cast<int>(instances.size()) < count)
+    {
+        int bestRotation = -1, bestX = 0, bestY = 0;
+        for(int r=0; r<ARRANGE_ROTATIONS; r++)
+        {
+            bool found = false;
+            for(int y=0; y<grid.height && !found; y++)
+            {
+                if (bestRotation > -1 && y > bestY)
+                    break;
+                for(int x=0; x<grid.width && !found; x++)
+                {
+                    if (bestRotation > -1 && y == bestY && x >= bestX)
+                        break;
+                    if (grid.fits(masks[r], x, y))
+                    {
+                        bestRotation = r;
+                        bestX = x;
+                        bestY = y;
+                        found = true;
+                    }
+                }
+            }
+        }
+        if (bestRotation < 0)
+            break;
+        grid.place(masks[bestRotation], bestX, bestY);
+        Point offset = Point(margin + int64_t(bestX) * ARRANGE_CELL_SIZE, margin + int64_t(bestY) * ARRANGE_CELL_SIZE) - masks[bestRotation].origin;
+        instances.push_back(ModelInstance(offset, 360.0 * bestRotation / ARRANGE_ROTATIONS));
+        Polygons copy = rotated[bestRotation];
+        transformPolygons(copy, ModelInstance(offset, 0.0), center);
+        placed.add(copy);
+    }
+    if (instances.size() < 1)
+        return 0;
+
+    //Move the packed copies together to the middle of the bed.
+    AABB aabb(placed);
+    Point shift = Point(bedSize.X / 2, bedSize.Y / 2) - Point((aabb.min.X + aabb.max.X) / 2, (aabb.min.Y + aabb.max.Y) / 2);
+    for(unsigned int i=0; i<instances.size(); i++)
+        instances[i].offset = instances[i].offset + shift;
+    return instances.size();
+}
+
+void addModelInstances(OptimizedModel* om, const vector<ModelInstance>& instances, Point center)
+{
+    if (instances.size() < 1)
+        return;
+    Point3 vMin(std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max(), om->vMin.z);
+    Point3 vMax(std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::min(), om->vMax.z);
+    for(unsigned int volumeIdx=0; volumeIdx<om->volumes.size(); volumeIdx++)
+    {
+        OptimizedVolume* volume = &om->volumes[volumeIdx];
+        vector<OptimizedPoint3> points;
+        vector<OptimizedFace> faces;
+        points.reserve(volume->points.size() * instances.size());
+        faces.reserve(volume->faces.size() * instances.size());
+        for(unsigned int i=0; i<instances.size(); i++)
+        {
+            PointMatrix matrix(instances[i].rotation);
+            int pointOffset = points.size();
+            int faceOffset = faces.size();
+            for(unsigned int n=0; n<volume->points.size(); n++)
+            {
+                OptimizedPoint3 point = volume->points[n];
+                Point p = transformPoint(Point(point.p.x, point.p.y), matrix, instances[i], center);
+                point.p.x = p.X;
+                point.p.y = p.Y;
+                for(unsigned int f=0; f<point.faceIndexList.size(); f++)
+                    point.faceIndexList[f] += faceOffset;
+                points.push_back(point);
+                if (point.p.x < vMin.x) vMin.x = point.p.x;
+                if (point.p.y < vMin.y) vMin.y = point.p.y;
+                if (point.p.x > vMax.x) vMax.x = point.p.x;
+                if (point.p.y > vMax.y) vMax.y = point.p.y;
+            }
+            for(unsigned int n=0; n<volume->faces.size(); n++)
+            {
+                OptimizedFace face = volume->faces[n];
+                for(unsigned int k=0; k<3; k++)
+                {
+                    face.index[k] += pointOffset;
+                    if (face.touching[k] > -1)
+                        face.touching[k] += faceOffset;
+                }
+                faces.push_back(face);
+            }
+        }
+        volume->points.swap(points);
+        volume->faces.swap(faces);
+    }
+    om->vMin = vMin;
+    om->vMax = vMax;
+    om->modelSize = vMax - vMin;
+}
+
+void setModelInstances(SliceDataStorage& storage, const vector<ModelInstance>& instances, Point center)
+{
+    storage.instances = instances;
+    storage.instanceCenter = center;
+    if (instances.size() < 1)
+        return;
+
+    //Grow the model bounds to the bounds of all instances, the corners of the bounding box are rotated with the instance.
+    Point corners[4] = {Point(storage.modelMin.x, storage.modelMin.y), Point(storage.modelMax.x, storage.modelMin.y), Point(storage.modelMax.x, storage.modelMax.y), Point(storage.modelMin.x, storage.modelMax.y)};
+    Polygons bounds;
+    for(unsigned int i=0; i<instances.size(); i++)
+    {
+        Polygons box;
+        PolygonRef p = box.newPoly();
+        for(unsigned int n=0; n<4; n++)
+            p.add(corners[n]);
+        transformPolygons(box, instances[i], center);
+        bounds.add(box);
+    }
+    AABB aabb(bounds);
+    storage.modelMin.x = aabb.min.X;
+    storage.modelMin.y = aabb.min.Y;
+    storage.modelMax.x = aabb.max.X;
+    storage.modelMax.y = aabb.max.Y;
+    storage.modelSize.x = storage.modelMax.x - storage.modelMin.x;
+    storage.modelSize.y = storage.modelMax.y - storage.modelMin.y;
+}
+
+int placedInstanceCount(SliceDataStorage& storage)
+{
+    return std::max(int(storage.instances.size()), 1);
+}
+
+void placePolygons(SliceDataStorage& storage, Polygons& polys, int instanceNr)
+{
+    if (storage.instances.size() > 0)
+        transformPolygons(polys, storage.instances[instanceNr], storage.instanceCenter);
+}
+
+Point placePoint(SliceDataStorage& storage, Point p, int instanceNr)
+{
+    if (storage.instances.size() < 1)
+        return p;
+    const ModelInstance& instance = storage.instances[instanceNr];
+    return transformPoint(p, PointMatrix(instance.rotation), instance, storage.instanceCenter);
+}
+
+}//namespace cura
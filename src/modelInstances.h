@@ -0,0 +1,37 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#ifndef MODEL_INSTANCES_H
+#define MODEL_INSTANCES_H
+
+#include "sliceDataStorage.h"
+#include "optimizedModel.h"
+
+namespace cura {
+
+//Parse a list of instances, in the form "x,y[,rotation];x,y[,rotation];..." with the offsets in micron and the rotation in degrees.
+bool parseModelInstances(const char* str, vector<ModelInstance>& instances);
+
+//Move a point of the model to where it is for the given instance, matrix is the rotation of that instance.
+Point transformPoint(Point p, const PointMatrix& matrix, const ModelInstance& instance, Point center);
+void transformPolygons(Polygons& polys, const ModelInstance& instance, Point center);
+
+//Fill the bed with copies of the model. The footprint is the outline of the model seen from above, copies are kept spacing apart and margin away from the edges of the bed.
+// A count of -1 places as many copies as fit. Returns the number of copies placed.
+int arrangeModelInstances(Polygons& footprint, Point center, Point bedSize, int spacing, int margin, int count, vector<ModelInstance>& instances);
+
+//Replace the model by all its instances. Only used for the support grid, the layer parts are placed with setModelInstances.
+void addModelInstances(OptimizedModel* om, const vector<ModelInstance>& instances, Point center);
+
+//Print the model at every instance, and grow the model bounds to the bounds of all instances. The layer parts are sliced and processed once
+// and stay where the model is. The G-code planning moves the insets, and the infill and skin lines it generated for a part, to each instance.
+// Ordering the moved paths and writing them is still done for every copy, that is what each extra instance costs.
+void setModelInstances(SliceDataStorage& storage, const vector<ModelInstance>& instances, Point center);
+
+//The number of copies the layer parts are printed at, a model without instances is printed once where it is.
+int placedInstanceCount(SliceDataStorage& storage);
+//Move polygons or a point of the model to an instance, nothing is moved when the model has no instances.
+void placePolygons(SliceDataStorage& storage, Polygons& polys, int instanceNr);
+Point placePoint(SliceDataStorage& storage, Point p, int instanceNr);
+
+}//namespace cura
+
+#endif//MODEL_INSTANCES_H
@@ -5,8 +5,6 @@
 #include "utils/logoutput.h"
 #include "optimizedModel.h"
 
-#define MELD_DIST MM2INT(0.03)
-
 #ifndef USE_G3LOG
 using namespace cura;
 #endif
@@ -6,6 +6,9 @@
 #include "modelFile/modelFile.h"
 #include "settings.h"
 
+//Points of the model closer together then this are welded into a single point.
+#define MELD_DIST MM2INT(0.03)
+
 class OptimizedFace
 {
 public:
@@ -54,19 +57,25 @@ public:
     Point3 modelSize;
     Point3 vMin, vMax;
 
-    OptimizedModel(SimpleModel* model, Point3 center)
+    OptimizedModel(SimpleModel* model, Point3 center, int autoCenter)
+    : OptimizedModel(model, center, autoCenter, model->min(), model->max())
+    {
+    }
+
+    //Optimize a piece of a bigger model, with modelMin and modelMax the bounds of the whole model, so the piece is moved the same way the whole model is.
+    OptimizedModel(SimpleModel* model, Point3 center, int autoCenter, Point3 modelMin, Point3 modelMax)
     {
         for(unsigned int i=0; i<model->volumes.size(); i++)
             volumes.push_back(OptimizedVolume(&model->volumes[i], this));
-        vMin = model->min();
-        vMax = model->max();
+        vMin = modelMin;
+        vMax = modelMax;
 
         Point3 vOffset((vMin.x + vMax.x) / 2, (vMin.y + vMax.y) / 2, vMin.z);
-        if(ConfigSettings::config->autoCenter != 1)
+        if(autoCenter != 1)
         {
             vOffset.x = 0;
             vOffset.y = 0;
-            if(ConfigSettings::config->autoCenter == 2)
+            if(autoCenter == 2)
                 vOffset.z = 0;
         }
         vOffset -= center;
@@ -1,5 +1,7 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include <map>
+#include <algorithm>
+#include <limits>
 
 #include "pathOrderOptimizer.h"
 
@@ -10,7 +12,83 @@ static uint32_t hashPoint(const Point& p)
     return (p.X / 20000) ^ (p.Y / 20000) << 8;
 }
 
+PathOrderCache::PathOrderCache(unsigned int maxEntries)
+: maxEntries(maxEntries), nextEntry(0)
+{
+}
+
+bool PathOrderCache::lookup(PathOrderOptimizer& optimizer, uint64_t hash)
+{
+    for(unsigned int n=0; n<entries.size(); n++)
+    {
+        Entry& e = entries[n];
+        if (e.hash != hash || e.startPoint.X != optimizer.startPoint.X || e.startPoint.Y != optimizer.startPoint.Y || e.polygons.size() != optimizer.polygons.size())
+            continue;
+        bool equal = true;
+        for(unsigned int i=0; i<optimizer.polygons.size() && equal; i++)
+            equal = e.polygons[i] == optimizer.polygons[i];
+        if (!equal)
+            continue;
+        optimizer.polyStart = e.polyStart;
+        optimizer.polyOrder = e.polyOrder;
+        return true;
+    }
+    return false;
+}
+
+void PathOrderCache::store(PathOrderOptimizer& optimizer, uint64_t hash)
+{
+    if (maxEntries < 1)
+        return;
+    unsigned int slot;
+    if (entries.size() < maxEntries)
+    {
+        slot = entries.size();
+        entries.push_back(Entry());
+    }else{
+        slot = nextEntry;
+        nextEntry = (nextEntry + 1) % maxEntries;
+    }
+    Entry& e = entries[slot];
+    e.hash = hash;
+    e.startPoint = optimizer.startPoint;
+    e.polygons.clear();
+    for(unsigned int i=0; i<optimizer.polygons.size(); i++)
+        e.polygons.add(optimizer.polygons[i]);
+    e.polyStart = optimizer.polyStart;
+    e.polyOrder = optimizer.polyOrder;
+}
+
+void PathOrderCache::clear()
+{
+    entries.clear();
+    nextEntry = 0;
+}
+
 void PathOrderOptimizer::optimize()
+{
+    uint64_t cacheHash = 0;
+    if (cache)
+    {
+        cacheHash = hashCombine(HASH_SEED, polygons.size());
+        for(unsigned int i=0; i<polygons.size(); i++)
+        {
+            cacheHash = hashCombine(cacheHash, polygons[i].size());
+            for(unsigned int j=0; j<polygons[i].size(); j++)
+            {
+                cacheHash = hashCombine(cacheHash, polygons[i][j].X);
+                cacheHash = hashCombine(cacheHash, polygons[i][j].Y);
+            }
+        }
+        if (cache->lookup(*this, cacheHash))
+            return;
+    }
+    optimizeOrder();
+    if (cache)
+        cache->store(*this, cacheHash);
+}
+
+void PathOrderOptimizer::optimizeOrder()
 {
     const float incommingPerpundicularNormalScale = 0.0001f;
     
@@ -157,4 +235,165 @@ void PathOrderOptimizer::optimize()
     }
 }
 
+#define PART_ORDER_SAMPLES 16
+#define PART_ORDER_MAX_2OPT_PARTS 256
+
+int64_t PartOrderOptimizer::travelCost(int64_t distance)
+{
+    if (distance < retractionMinimalDistance)
+        return distance;
+    return distance + retractionCost;
+}
+
+//Shortest distance between the samples of a part and a point set, compared squared so only the result needs a square root.
+static int64_t closestDistance(const vector<Point>& points, const vector<Point>& samples)
+{
+    int64_t best2 = std::numeric_limits<int64_t>::max();
+    for(Point p : points)
+        for(Point s : samples)
+            best2 = std::min(best2, vSize2(s - p));
+    return sqrt(best2);
+}
+
+//Lower bound of the distance between two boxes, zero when they overlap.
+static int64_t boxDistance(const AABB& a, const AABB& b)
+{
+    int64_t dx = std::max<int64_t>(0, std::max(a.min.X - b.max.X, b.min.X - a.max.X));
+    int64_t dy = std::max<int64_t>(0, std::max(a.min.Y - b.max.Y, b.min.Y - a.max.Y));
+    return sqrt(dx * dx + dy * dy);
+}
+
+int64_t PartOrderOptimizer::pointCost(Point p, int partNr)
+{
+    int64_t best2 = std::numeric_limits<int64_t>::max();
+    for(Point s : samples[partNr])
+        best2 = std::min(best2, vSize2(s - p));
+    return travelCost(sqrt(best2));
+}
+
+int64_t PartOrderOptimizer::partCost(int a, int b)
+{
+    int64_t& cost = costCache[a * outlines.size() + b];
+    if (cost < 0)
+    {
+        cost = travelCost(closestDistance(samples[a], samples[b]));
+        costCache[b * outlines.size() + a] = cost;
+    }
+    return cost;
+}
+
+int64_t PartOrderOptimizer::endCost(int partNr)
+{
+    int64_t& cost = endCostCache[partNr];
+    if (cost < 0)
+        cost = (nextLayerPoints.size() > 0) ? travelCost(closestDistance(nextLayerPoints, samples[partNr])) : 0;
+    return cost;
+}
+
+//Cost from one position in the order to another, -1 is the start point and outlines.size() is the start of the next layer.
+int64_t PartOrderOptimizer::orderCost(int from, int to)
+{
+    if (from < 0)
+        return pointCost(startPoint, to);
+    if (to >= static_cast<int>(outlines.size()))
+        return endCost(from);
+    return partCost(from, to);
+}
+
+//Lower bound of orderCost from the boxes of the samples, travelCost only grows with the distance.
+int64_t PartOrderOptimizer::orderCostBound(int from, int to)
+{
+    if (to >= static_cast<int>(outlines.size()))
+        return 0;
+    if (from < 0)
+    {
+        AABB start;
+        start.min = start.max = startPoint;
+        return travelCost(boxDistance(start, boxes[to]));
+    }
+    return travelCost(boxDistance(boxes[from], boxes[to]));
+}
+
+void PartOrderOptimizer::optimize()
+{
+    unsigned int count = outlines.size();
+    polyOrder.clear();
+    if (count < 1)
+        return;
+
+    //Each part is represented by a few points spread over its outline, the travel to a part ends at the closest of them.
+    samples.resize(count);
+    boxes.resize(count);
+    for(unsigned int n=0; n<count; n++)
+    {
+        PolygonRef outline = outlines[n];
+        unsigned int step = std::max(1u, outline.size() / PART_ORDER_SAMPLES);
+        for(unsigned int i=0; i<outline.size(); i+=step)
+            samples[n].push_back(outline[i]);
+        if (samples[n].size() < 1)
+            samples[n].push_back(startPoint);
+        boxes[n].min = boxes[n].max = samples[n][0];
+        for(Point p : samples[n])
+        {
+            boxes[n].min.X = std::min(boxes[n].min.X, p.X);
+            boxes[n].min.Y = std::min(boxes[n].min.Y, p.Y);
+            boxes[n].max.X = std::max(boxes[n].max.X, p.X);
+            boxes[n].max.Y = std::max(boxes[n].max.Y, p.Y);
+        }
+    }
+    //The costs are only calculated for the pairs that are looked at.
+    costCache.assign(count * count, -1);
+    endCostCache.assign(count, -1);
+
+    //Nearest first. A part is skipped without calculating its cost when its box is already further away than the best part.
+    vector<bool> picked(count, false);
+    int current = -1;
+    for(unsigned int n=0; n<count; n++)
+    {
+        int best = -1;
+        int64_t bestCost = std::numeric_limits<int64_t>::max();
+        for(unsigned int i=0; i<count; i++)
+        {
+            if (picked[i] || (best > -1 && orderCostBound(current, i) >= bestCost))
+                continue;
+            int64_t cost = orderCost(current, i);
+            if (cost < bestCost)
+            {
+                best = i;
+                bestCost = cost;
+            }
+        }
+        picked[best] = true;
+        polyOrder.push_back(best);
+        current = best;
+    }
+
+    //2-opt: reverse a run of the order when that makes the travel into and out of the run cheaper.
+    if (count < 3 || count > PART_ORDER_MAX_2OPT_PARTS)
+        return;
+    int end = count;
+    bool improved = true;
+    for(int pass=0; pass<8 && improved; pass++)
+    {
+        improved = false;
+        for(int i=0; i<end - 1; i++)
+        {
+            int before = (i > 0) ? polyOrder[i - 1] : -1;
+            for(int j=i+1; j<end; j++)
+            {
+                int after = (j + 1 < end) ? polyOrder[j + 1] : end;
+                int64_t oldCost = orderCost(before, polyOrder[i]) + orderCost(polyOrder[j], after);
+                if (orderCostBound(before, polyOrder[j]) + orderCostBound(polyOrder[i], after) >= oldCost)
+                    continue;
+                int64_t newCost = orderCost(before, polyOrder[j]) + orderCost(polyOrder[i], after);
+                if (newCost < oldCost)
+                {
+                    std::reverse(polyOrder.begin() + i, polyOrder.begin() + j + 1);
+                    improved = true;
+                }
+            }
+        }
+    }
+}
+
 }//namespace cura
@@ -7,6 +7,37 @@
 
 namespace cura {
 
+class PathOrderOptimizer;
+
+/**
+ * Cache for path orders. Identical layers, like the walls of a box, feed the exact same polygons and start point to the optimizer,
+ * so the order found for those is kept. The oldest entry is replaced when the cache is full.
+ */
+class PathOrderCache
+{
+private:
+    class Entry
+    {
+    public:
+        uint64_t hash;
+        Point startPoint;
+        Polygons polygons;
+        vector<int> polyStart;
+        vector<int> polyOrder;
+    };
+    vector<Entry> entries;
+    unsigned int maxEntries;
+    unsigned int nextEntry;
+public:
+    PathOrderCache(unsigned int maxEntries = 64);
+
+    //Fill in the order of the optimizer when it has been calculated before, returns false if it is not in the cache.
+    bool lookup(PathOrderOptimizer& optimizer, uint64_t hash);
+    void store(PathOrderOptimizer& optimizer, uint64_t hash);
+
+    void clear();
+};
+
 class PathOrderOptimizer
 {
 public:
@@ -14,10 +45,12 @@ public:
     vector<PolygonRef> polygons;
     vector<int> polyStart;
     vector<int> polyOrder;
+    PathOrderCache* cache;
 
-    PathOrderOptimizer(Point startPoint)
+    PathOrderOptimizer(Point startPoint, PathOrderCache* cache = nullptr)
     {
         this->startPoint = startPoint;
+        this->cache = cache;
     }
 
     void addPolygon(PolygonRef polygon)
@@ -32,6 +65,49 @@ public:
     }
     
     void optimize();
+private:
+    void optimizeOrder();
+};
+
+/**
+ * Orders the parts (or support islands) of a layer on the cost of the travel moves between them. A travel between two parts is the
+ * distance between their closest points, and a move that is long enough to retract also pays the time of the retraction and z-hop,
+ * expressed as the distance that could be travelled in that time. The order is built nearest first and improved with 2-opt,
+ * where the end of the order is pulled towards the parts of the next layer, which is where the next layer starts.
+ */
+class PartOrderOptimizer
+{
+public:
+    Point startPoint;
+    int64_t retractionCost;
+    int retractionMinimalDistance;
+    vector<PolygonRef> outlines;
+    vector<Point> nextLayerPoints;
+    vector<int> polyOrder;
+
+    PartOrderOptimizer(Point startPoint, int64_t retractionCost, int retractionMinimalDistance)
+    : startPoint(startPoint), retractionCost(retractionCost), retractionMinimalDistance(retractionMinimalDistance)
+    {
+    }
+
+    void addPart(PolygonRef outline)
+    {
+        outlines.push_back(outline);
+    }
+
+    void optimize();
+private:
+    vector<vector<Point>> samples;
+    vector<AABB> boxes;
+    vector<int64_t> costCache;
+    vector<int64_t> endCostCache;
+
+    int64_t travelCost(int64_t distance);
+    int64_t pointCost(Point p, int partNr);
+    int64_t partCost(int a, int b);
+    int64_t endCost(int partNr);
+    int64_t orderCost(int from, int to);
+    int64_t orderCostBound(int from, int to);
 };
 
 }//namespace cura
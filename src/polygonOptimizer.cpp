@@ -5,50 +5,103 @@ namespace cura {
 
 void optimizePolygon(PolygonRef poly)
 {
-    Point p0 = poly[poly.size()-1];
-    for(unsigned int i=0;i<poly.size();i++)
+    //Kept points are compacted to the front of the polygon in a single pass, instead of erasing every removed point.
+    unsigned int count = poly.size();
+    if (count < 1)
+        return;
+    ClipperLib::Path::iterator out = poly.begin();
+    unsigned int keep = 0;
+    Point p0 = poly[count-1];
+    for(unsigned int i=0;i<count;i++)
     {
         Point p1 = poly[i];
         if (shorterThen(p0 - p1, MICRON2INT(10)))
         {
-            poly.remove(i);
-            i --;
+            continue;
         }else if (shorterThen(p0 - p1, MICRON2INT(500)))
         {
             Point p2;
-            if (i < poly.size() - 1)
+            if (i < count - 1)
                 p2 = poly[i+1];
-            else
+            else if (keep > 0)
                 p2 = poly[0];
+            else
+                p2 = p1;
             
             Point diff0 = normal(p1 - p0, 10000000);
             Point diff2 = normal(p1 - p2, 10000000);
             
             int64_t d = dot(diff0, diff2);
             if (d < -99999999999999LL)
-            {
-                poly.remove(i);
-                i --;
-            }else{
-                p0 = p1;
-            }
-        }else{
-            p0 = p1;
+                continue;
         }
+        out[keep++] = p1;
+        p0 = p1;
     }
+    poly.resize(keep);
 }
 
-void optimizePolygons(Polygons& polys)
+//Check if all points from firstIdx up to and including lastIdx lie within tolerance of the line segment a-b.
+static bool segmentCoversPoints(Point a, Point b, PolygonRef poly, unsigned int firstIdx, unsigned int lastIdx, int tolerance)
 {
-    for(unsigned int n=0;n<polys.size();n++)
+    Point ab = b - a;
+    int64_t length2 = vSize2(ab);
+    int64_t tolerance2 = int64_t(tolerance) * int64_t(tolerance);
+    for(unsigned int n=firstIdx; n<=lastIdx; n++)
     {
-        optimizePolygon(polys[n]);
-        if (polys[n].size() < 3)
+        Point ap = poly[n] - a;
+        int64_t t = dot(ap, ab);
+        Point offset;
+        if (t <= 0 || length2 == 0)
+            offset = ap;
+        else if (t >= length2)
+            offset = poly[n] - b;
+        else
+            offset = ap - Point(ab.X * double(t) / double(length2), ab.Y * double(t) / double(length2));
+        if (vSize2(offset) > tolerance2)
+            return false;
+    }
+    return true;
+}
+
+void simplifyPolygon(PolygonRef poly, int tolerance)
+{
+    unsigned int count = poly.size();
+    if (count <= 3 || tolerance <= 0)
+        return;
+    //Walk from the last kept point and skip as many following points as a single line can replace within the tolerance.
+    // The look ahead is bounded by SIMPLIFY_MAX_WINDOW, which keeps the whole pass linear in the number of points.
+    ClipperLib::Path::iterator out = poly.begin();
+    unsigned int keep = 1;
+    Point anchor = poly[0];
+    unsigned int i = 1;
+    while(i < count)
+    {
+        unsigned int end = i;
+        while(end + 1 <= count && end + 1 - i <= SIMPLIFY_MAX_WINDOW)
         {
-            polys.remove(n);
-            n--;
+            Point next = end + 1 < count ? poly[end + 1] : poly[0];
+            if (!segmentCoversPoints(anchor, next, poly, i, end, tolerance))
+                break;
+            end++;
         }
+        if (end == count)
+            break;
+        anchor = poly[end];
+        out[keep++] = anchor;
+        i = end + 1;
+    }
+    poly.resize(keep);
+}
+
+void optimizePolygons(Polygons& polys, int simplifyTolerance)
+{
+    for(unsigned int n=0;n<polys.size();n++)
+    {
+        optimizePolygon(polys[n]);
+        simplifyPolygon(polys[n], simplifyTolerance);
     }
+    polys.removeSmallPolygons(3);
 }
 
 }//namespace cura
@@ -4,11 +4,19 @@
 
 #include "utils/polygon.h"
 
+//Maximum number of points a single simplified line may replace.
+#define SIMPLIFY_MAX_WINDOW 32
+
 namespace cura {
 
+//Remove duplicate points and tiny near straight corners.
 void optimizePolygon(PolygonRef poly);
 
-void optimizePolygons(Polygons& polys);
+//Remove every point that can be left out without moving the outline more then tolerance (in micron).
+void simplifyPolygon(PolygonRef poly, int tolerance);
+
+//Optimize and simplify all polygons, polygons with less then 3 points left are removed. A tolerance of 0 skips the simplification.
+void optimizePolygons(Polygons& polys, int simplifyTolerance);
 
 }//namespace cura
 
@@ -1,6 +1,7 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include "raft.h"
 #include "support.h"
+#include "modelInstances.h"
 
 namespace cura {
 
@@ -10,9 +11,14 @@ void generateRaft(SliceDataStorage& storage, int distance)
     {
         if (storage.volumes[volumeIdx].layers.size() < 1) continue;
         SliceLayer* layer = &storage.volumes[volumeIdx].layers[0];
-        for(unsigned int i=0; i<layer->parts.size(); i++)
+        for(int instanceNr=0; instanceNr<placedInstanceCount(storage); instanceNr++)
         {
-            storage.raftOutline = storage.raftOutline.unionPolygons(layer->parts[i].outline.offset(distance));
+            for(unsigned int i=0; i<layer->parts.size(); i++)
+            {
+                Polygons outline = layer->parts[i].outline.offset(distance);
+                placePolygons(storage, outline, instanceNr);
+                storage.raftOutline = storage.raftOutline.unionPolygons(outline);
+            }
         }
     }
 
@@ -17,14 +17,14 @@ using namespace cura;
 #define SETTING(name, default) do { _index.push_back(_ConfigSettingIndex(STRINGIFY(name), &name)); name = (default); } while(0)
 #define SETTING2(name, altname, default) do { _index.push_back(_ConfigSettingIndex(STRINGIFY(name), &name)); _index.push_back(_ConfigSettingIndex(STRINGIFY(altname), &name)); name = (default); } while(0)
 
-ConfigSettings *ConfigSettings::config = NULL;
-
 ConfigSettings::ConfigSettings()
 {
-    config = this;
     SETTING(nozzleSize, 400);
     SETTING(layerThickness, 100);
     SETTING(initialLayerThickness, 300);
+    SETTING(adaptiveLayerCuspHeight, 0);
+    SETTING(adaptiveLayerMinThickness, 60);
+    SETTING(adaptiveLayerMaxThickness, 300);
     SETTING(filamentDiameter, 2890);
     SETTING(filamentFlow, 100);
     SETTING(layer0extrusionWidth, 600);
@@ -46,6 +46,11 @@ ConfigSettings::ConfigSettings()
 
     SETTING(sparseInfillLineDistance, 100 * extrusionWidth / 20);
     SETTING(infillOverlap, 15);
+    SETTING(sparseInfillCombineCount, 1);
+    SETTING(sparseInfillSupportOnly, 0);
+    SETTING(sparseInfillSupportAngle, 40);
+    SETTING(gradualInfillSteps, 0);
+    SETTING(gradualInfillStepHeight, 1500);
     SETTING(infillSpeed, 50);
     SETTING(infillPattern, INFILL_AUTOMATIC);
     SETTING(skinSpeed, 50);
@@ -75,6 +80,10 @@ ConfigSettings::ConfigSettings()
     SETTING2(objectPosition.Y, posy, 102500);
     SETTING(objectSink, 0);
     SETTING(autoCenter, 1);
+    SETTING(machineWidth, 205000);
+    SETTING(machineDepth, 205000);
+    SETTING(arrangeCount, 0);
+    SETTING(arrangeSpacing, 3000);
 
     SETTING(raftMargin, 5000);
     SETTING(raftLineSpacing, 1000);
@@ -100,9 +109,13 @@ ConfigSettings::ConfigSettings()
     SETTING(fanSpeedMax, 100);
 
     SETTING(fixHorrible, 0);
+    SETTING(outlineSimplifyTolerance, 0);
+    SETTING(outOfCoreBandHeight, 0);
     SETTING(spiralizeMode, 0);
     SETTING(simpleMode, 0);
     SETTING(gcodeFlavor, GCODE_FLAVOR_REPRAP);
+    SETTING(arcFittingTolerance, 0);
+    SETTING(guiPackedPolygons, 0);
 
     memset(extruderOffset, 0, sizeof(extruderOffset));
     SETTING(extruderOffset[0].X, 0); // No one says that extruder 0 can not have an offset!
@@ -167,11 +180,36 @@ ConfigSettings::ConfigSettings()
     SETTING(max_xy_jerk, 20.0 * 1000);
     SETTING(max_z_jerk, 0.4 * 1000);
     SETTING(max_e_jerk, 5.0 * 1000);
+
+    //Slice server settings
+    SETTING(serverWorkerCount, 0);
+    SETTING(serverMemoryBudget, 0);
 }
 
 #undef STRINGIFY
 #undef SETTING
 
+ConfigSettings::ConfigSettings(const ConfigSettings& other)
+: ConfigSettings()
+{
+    *this = other;
+}
+
+ConfigSettings& ConfigSettings::operator=(const ConfigSettings& other)
+{
+    if (this == &other)
+        return *this;
+    for(unsigned int n=0; n < _index.size(); n++)
+        *_index[n].ptr = *other._index[n].ptr;
+    matrix = other.matrix;
+    startCode = other.startCode;
+    endCode = other.endCode;
+    preSwitchExtruderCode = other.preSwitchExtruderCode;
+    postSwitchExtruderCode = other.postSwitchExtruderCode;
+    modelInstances = other.modelInstances;
+    return *this;
+}
+
 bool ConfigSettings::setSetting(const char* key, const char* value)
 {
     for(unsigned int n=0; n < _index.size(); n++)
@@ -202,6 +240,11 @@ bool ConfigSettings::setSetting(const char* key, const char* value)
         this->postSwitchExtruderCode = value;
         return true;
     }
+    if (stringcasecompare(key, "modelInstances") == 0)
+    {
+        this->modelInstances = value;
+        return true;
+    }
     return false;
 }
 
@@ -126,10 +126,12 @@ class ConfigSettings
 private:
     std::vector<_ConfigSettingIndex> _index;
 public:
-    static ConfigSettings *config; // allow access to config settings from everywhere
     int nozzleSize;
     int layerThickness;
     int initialLayerThickness;
+    int adaptiveLayerCuspHeight; //Maximum step in micron that a layer may leave on a sloped surface, the layer thickness is chosen per layer to stay below it. 0 to use layerThickness for all layers.
+    int adaptiveLayerMinThickness; //Thinnest layer in micron when adaptive layers are used.
+    int adaptiveLayerMaxThickness; //Thickest layer in micron when adaptive layers are used.
     int filamentDiameter;
     int filamentFlow;
     int layer0extrusionWidth;
@@ -165,6 +167,11 @@ public:
 
     //Infill settings
     int sparseInfillLineDistance;
+    int sparseInfillSupportOnly; //Only print sparse infill where it holds up skin higher up, big hollow parts are left empty inside.
+    int sparseInfillSupportAngle; //Overhang angle in degrees with which the infill below a skin may narrow down when sparseInfillSupportOnly is used.
+    int gradualInfillSteps; //Number of times the sparse line distance is doubled further below the top surfaces, 0 for the same infill everywhere.
+    int gradualInfillStepHeight; //Height in micron of each gradual infill step.
+    int sparseInfillCombineCount; //Print the sparse infill once every this many layers at the combined height, as long as that height is not more then the nozzle size. 1 to print it every layer.
     int infillOverlap;
     int infillSpeed;
     int infillPattern;
@@ -209,17 +216,26 @@ public:
     IntPoint objectPosition;
     int objectSink;
     int autoCenter;
+    int machineWidth; //Size of the build plate in micron, used to arrange the copies of the model.
+    int machineDepth;
+    int arrangeCount; //Number of copies of the model to arrange on the build plate, -1 for as many as fit, 0 to not arrange and use modelInstances.
+    int arrangeSpacing; //Distance in micron between the arranged copies.
 
     int fixHorrible;
+    int outlineSimplifyTolerance; //Points of the sliced outlines and insets are removed as long as the outline moves less then this many micron, 0 to disable.
+    int outOfCoreBandHeight; //Slice model files from disk in bands of this height in micron, with only one band in memory at a time. For models larger then memory, 0 to slice in memory.
     int spiralizeMode;
     int simpleMode;
     int gcodeFlavor;
+    int arcFittingTolerance; //Maximum deviation in micron when curved extrusion paths are written as G2/G3 arcs, 0 to disable. Only used for flavors that support arcs.
+    int guiPackedPolygons; //Send polygons to the GUI as GUI_CMD_SEND_POLYGONS_PACKED frames, for interfaces that support them.
 
     IntPoint extruderOffset[MAX_EXTRUDERS];
     std::string startCode;
     std::string endCode;
     std::string preSwitchExtruderCode;
     std::string postSwitchExtruderCode;
+    std::string modelInstances; //Copies of the model on the plate, "x,y[,rotation];..." with the offset from the object position in micron and the rotation in degrees. Empty for a single copy.
     
     //Time estimate settings
     int acceleration;
@@ -228,7 +244,14 @@ public:
     int max_z_jerk;
     int max_e_jerk;
 
+    //Slice server settings
+    int serverWorkerCount; //Number of jobs sliced at the same time, 0 for one per core.
+    int serverMemoryBudget; //Estimated memory in MB that the running jobs may use together, 0 for no limit.
+
     ConfigSettings();
+    //The setting index points into the object itself, so copies re-register their own index and only copy the values.
+    ConfigSettings(const ConfigSettings& other);
+    ConfigSettings& operator=(const ConfigSettings& other);
     bool setSetting(const char* key, const char* value);
     bool readSettings(void);
     bool readSettings(const char* path);
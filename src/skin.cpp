@@ -3,6 +3,43 @@
 
 namespace cura {
 
+//The area inside the last inset is the base for both the skin and the sparse infill, so it is only offset once per part.
+static const Polygons& getInfillBase(SliceLayerPart* part, int extrusionWidth)
+{
+    if (part->infillBaseWidth != extrusionWidth)
+    {
+        part->infillBase = part->insets[part->insets.size() - 1].offset(-extrusionWidth/2);
+        part->infillBaseWidth = extrusionWidth;
+    }
+    return part->infillBase;
+}
+
+//Combined fingerprint of all the parts in a layer, layers outside of the model get a fixed marker.
+static uint64_t layerFingerprint(SliceVolumeStorage& storage, int layerNr)
+{
+    if (layerNr < 0 || layerNr >= static_cast<int>(storage.layers.size()))
+        return 0;
+    SliceLayer* layer = &storage.layers[layerNr];
+    uint64_t hash = hashCombine(HASH_SEED, layer->parts.size());
+    for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+        hash = hashCombine(hash, layer->parts[partNr].fingerprint);
+    return hash;
+}
+
+//Find a part in the previous layer which has the same skin fingerprint, its skin and sparse areas are the same as those of this part.
+static SliceLayerPart* findIdenticalSkinPart(int layerNr, SliceVolumeStorage& storage, SliceLayerPart* part)
+{
+    if (layerNr < 1 || part->skinFingerprint == 0)
+        return nullptr;
+    SliceLayer* previousLayer = &storage.layers[layerNr - 1];
+    for(unsigned int partNr=0; partNr<previousLayer->parts.size(); partNr++)
+    {
+        if (previousLayer->parts[partNr].skinFingerprint == part->skinFingerprint)
+            return &previousLayer->parts[partNr];
+    }
+    return nullptr;
+}
+
 void generateSkins(int layerNr, SliceVolumeStorage& storage, int extrusionWidth, int downSkinCount, int upSkinCount, int infillOverlap)
 {
     SliceLayer* layer = &storage.layers[layerNr];
@@ -10,8 +47,22 @@ void generateSkins(int layerNr, SliceVolumeStorage& storage, int extrusionWidth,
     for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
     {
         SliceLayerPart* part = &layer->parts[partNr];
+        part->skinFingerprint = 0;
+        if (part->fingerprint != 0)
+        {
+            uint64_t hash = hashCombine(part->fingerprint, layerFingerprint(storage, layerNr - downSkinCount));
+            hash = hashCombine(hash, layerFingerprint(storage, layerNr + upSkinCount));
+            hash = hashCombine(hash, extrusionWidth);
+            part->skinFingerprint = hashCombine(hash, infillOverlap);
+        }
+        SliceLayerPart* identical = findIdenticalSkinPart(layerNr, storage, part);
+        if (identical)
+        {
+            part->skinOutline = identical->skinOutline;
+            continue;
+        }
         
-        Polygons upskin = part->insets[part->insets.size() - 1].offset(-extrusionWidth/2);
+        Polygons upskin = getInfillBase(part, extrusionWidth);
         Polygons downskin = upskin;
         
         if (part->insets.size() > 1)
@@ -62,8 +113,14 @@ void generateSparse(int layerNr, SliceVolumeStorage& storage, int extrusionWidth
     for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
     {
         SliceLayerPart* part = &layer->parts[partNr];
+        SliceLayerPart* identical = findIdenticalSkinPart(layerNr, storage, part);
+        if (identical)
+        {
+            part->sparseOutline = identical->sparseOutline;
+            continue;
+        }
 
-        Polygons sparse = part->insets[part->insets.size() - 1].offset(-extrusionWidth/2);
+        Polygons sparse = getInfillBase(part, extrusionWidth);
         Polygons downskin = sparse;
         Polygons upskin = sparse;
         
@@ -117,4 +174,99 @@ void generateSparse(int layerNr, SliceVolumeStorage& storage, int extrusionWidth
     }
 }
 
+void generateSupportOnlySparse(int layerNr, SliceVolumeStorage& storage, Polygons& supportedArea, int overhangOffset)
+{
+    SliceLayer* layer = &storage.layers[layerNr];
+
+    supportedArea = supportedArea.offset(-overhangOffset);
+    if (layerNr + 1 < static_cast<int>(storage.layers.size()))
+    {
+        SliceLayer* layer2 = &storage.layers[layerNr + 1];
+        for(unsigned int partNr2=0; partNr2<layer2->parts.size(); partNr2++)
+            supportedArea = supportedArea.unionPolygons(layer2->parts[partNr2].skinOutline);
+    }
+
+    for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+    {
+        SliceLayerPart* part = &layer->parts[partNr];
+        part->sparseOutline = part->sparseOutline.intersection(supportedArea);
+    }
+}
+
+void generateGradualSparse(int layerNr, SliceVolumeStorage& storage, int stepCount, int stepLayerCount, int extrusionWidth)
+{
+    SliceLayer* layer = &storage.layers[layerNr];
+
+    for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+    {
+        SliceLayerPart* part = &layer->parts[partNr];
+        part->gradualSparseOutlines.clear();
+
+        //Each step keeps the area that is still inside the model on every layer up to stepLayerCount layers higher then the previous step,
+        // so an area below a top surface that is closer then a full step is never made sparser.
+        Polygons current = part->sparseOutline;
+        for(int stepNr = 1; stepNr <= stepCount && current.size() > 0; stepNr++)
+        {
+            Polygons deeper = current;
+            for(int layerNr2 = layerNr + (stepNr - 1) * stepLayerCount + 1; layerNr2 <= layerNr + stepNr * stepLayerCount && deeper.size() > 0; layerNr2++)
+            {
+                Polygons inside;
+                if (layerNr2 < static_cast<int>(storage.layers.size()))
+                {
+                    SliceLayer* layer2 = &storage.layers[layerNr2];
+                    for(unsigned int partNr2=0; partNr2<layer2->parts.size(); partNr2++)
+                    {
+                        if (part->boundaryBox.hit(layer2->parts[partNr2].boundaryBox))
+                            inside.add(layer2->parts[partNr2].insets[layer2->parts[partNr2].insets.size() - 1]);
+                    }
+                }
+                deeper = deeper.intersection(inside);
+            }
+            //Areas thinner then a line stay at the higher density.
+            deeper = deeper.offset(-extrusionWidth / 2).offset(extrusionWidth / 2);
+            if (stepNr == 1)
+                part->sparseOutline = current.difference(deeper);
+            else
+                part->gradualSparseOutlines.push_back(current.difference(deeper));
+            current = deeper;
+        }
+        if (current.size() > 0)
+            part->gradualSparseOutlines.push_back(current);
+    }
+}
+
+void combineSparseLayers(int layerNr, SliceVolumeStorage& storage, int combineCount, int extrusionWidth)
+{
+    SliceLayer* layer = &storage.layers[layerNr];
+    Polygons combined;
+    for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+    {
+        SliceLayerPart* part = &layer->parts[partNr];
+        Polygons common = part->sparseOutline;
+        for(int layerNr2 = layerNr - combineCount + 1; layerNr2 < layerNr && common.size() > 0; layerNr2++)
+        {
+            SliceLayer* layer2 = &storage.layers[layerNr2];
+            Polygons sparse;
+            for(unsigned int partNr2=0; partNr2<layer2->parts.size(); partNr2++)
+            {
+                if (part->boundaryBox.hit(layer2->parts[partNr2].boundaryBox))
+                    sparse.add(layer2->parts[partNr2].sparseOutline);
+            }
+            common = common.intersection(sparse);
+        }
+        part->combinedSparseOutline = common;
+        //What is left of the sparse area is often a thin strip along the insets, strips thinner then a line would only give tiny bits of infill.
+        part->sparseOutline = part->sparseOutline.difference(common).offset(-extrusionWidth / 2).offset(extrusionWidth / 2);
+        combined.add(common);
+    }
+    if (combined.size() < 1)
+        return;
+    for(int layerNr2 = layerNr - combineCount + 1; layerNr2 < layerNr; layerNr2++)
+    {
+        SliceLayer* layer2 = &storage.layers[layerNr2];
+        for(unsigned int partNr2=0; partNr2<layer2->parts.size(); partNr2++)
+            layer2->parts[partNr2].sparseOutline = layer2->parts[partNr2].sparseOutline.difference(combined).offset(-extrusionWidth / 2).offset(extrusionWidth / 2);
+    }
+}
+
 }//namespace cura
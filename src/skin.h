@@ -6,8 +6,16 @@
 
 namespace cura {
 
+//Parts with the same skin fingerprint as a part in the previous layer copy its results, so generateSkins has to be called before generateSparse.
 void generateSkins(int layerNr, SliceVolumeStorage& storage, int extrusionWidth, int downSkinCount, int upSkinCount, int infillOverlap);
 void generateSparse(int layerNr, SliceVolumeStorage& storage, int extrusionWidth, int downSkinCount, int upSkinCount);
+//Limit the sparse area to the parts that hold up skin higher up. Called from the top layer down, supportedArea carries the area that needs infill from the layer above
+//and is shrunk by overhangOffset every layer, so the infill below a skin narrows down like an overhang.
+void generateSupportOnlySparse(int layerNr, SliceVolumeStorage& storage, Polygons& supportedArea, int overhangOffset);
+//Split the sparse area in steps of stepLayerCount layers below the top surfaces. The area deeper then the first step is moved to gradualSparseOutlines, to be filled with less infill.
+void generateGradualSparse(int layerNr, SliceVolumeStorage& storage, int stepCount, int stepLayerCount, int extrusionWidth);
+//Move the sparse area that the combineCount layers up to layerNr have in common to the combinedSparseOutline of layerNr, so that infill is printed once at the combined height.
+void combineSparseLayers(int layerNr, SliceVolumeStorage& storage, int combineCount, int extrusionWidth);
 
 }//namespace cura
 
@@ -1,6 +1,7 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include "skirt.h"
 #include "support.h"
+#include "modelInstances.h"
 
 namespace cura {
 
@@ -17,18 +18,23 @@ void generateSkirt(SliceDataStorage& storage, int distance, int extrusionWidth,
         {
             if (storage.volumes[volumeIdx].layers.size() < 1) continue;
             SliceLayer* layer = &storage.volumes[volumeIdx].layers[0];
-            for(unsigned int i=0; i<layer->parts.size(); i++)
+            for(int instanceNr=0; instanceNr<placedInstanceCount(storage); instanceNr++)
             {
-                if (externalOnly)
+                for(unsigned int i=0; i<layer->parts.size(); i++)
                 {
-                    Polygons p;
-                    p.add(layer->parts[i].outline[0]);
-                    skirtPolygons = skirtPolygons.unionPolygons(p.offset(offsetDistance));
-                }
-                else
-                    skirtPolygons = skirtPolygons.unionPolygons(layer->parts[i].outline.offset(offsetDistance));
+                    Polygons outline = layer->parts[i].outline;
+                    placePolygons(storage, outline, instanceNr);
+                    if (externalOnly)
+                    {
+                        Polygons p;
+                        p.add(outline[0]);
+                        skirtPolygons = skirtPolygons.unionPolygons(p.offset(offsetDistance));
+                    }
+                    else
+                        skirtPolygons = skirtPolygons.unionPolygons(outline.offset(offsetDistance));
 
-                supportGenerator.polygons = supportGenerator.polygons.difference(layer->parts[i].outline);
+                    supportGenerator.polygons = supportGenerator.polygons.difference(outline);
+                }
             }
         }
         
@@ -25,6 +25,28 @@ public:
     vector<Polygons> insets;
     Polygons skinOutline;
     Polygons sparseOutline;
+    Polygons combinedSparseOutline; //Sparse area shared with the layers below, printed once on this layer for all of them.
+    vector<Polygons> gradualSparseOutlines; //Sparse areas further below the top surfaces, entry n is filled at 2^(n+1) times the sparse line distance.
+    Polygons infillBase; //Area inside the last inset, shared by the skin and sparse generation.
+    int infillBaseWidth;
+
+    //Fingerprints of the processing steps. Consecutive layers with identical parts, like the walls of a box, copy the results of the previous layer.
+    uint64_t outlineHash;       //Hash of the outline, the input of the insets.
+    uint64_t fingerprint;       //Hash of the outline and all insets.
+    uint64_t skinFingerprint;   //Hash of the fingerprints that the skin and sparse areas are calculated from.
+
+    SliceLayerPart() : infillBaseWidth(-1), outlineHash(0), fingerprint(0), skinFingerprint(0) {}
+};
+
+//The height of a layer, shared by all the volumes. printZ is the top of the layer where it is printed, without the raft.
+class LayerHeight
+{
+public:
+    int32_t sliceZ;
+    int32_t printZ;
+    int32_t thickness;
+
+    LayerHeight(int32_t sliceZ, int32_t printZ, int32_t thickness) : sliceZ(sliceZ), printZ(printZ), thickness(thickness) {}
 };
 
 class SliceLayer
@@ -45,6 +67,15 @@ public:
     
     SupportPoint(int32_t z, double cosAngle) : z(z), cosAngle(cosAngle) {}
 };
+//A Z interval in which a grid cell needs support: zLow < z <= zHigh
+class SupportRange
+{
+public:
+    int32_t zLow;
+    int32_t zHigh;
+
+    SupportRange(int32_t zLow, int32_t zHigh) : zLow(zLow), zHigh(zHigh) {}
+};
 class SupportStorage
 {
 public:
@@ -53,12 +84,25 @@ public:
     bool everywhere;
     int XYDistance;
     int ZDistance;
+    double cosAngle;
     
     Point gridOffset;
     int32_t gridScale;
     int32_t gridWidth, gridHeight;
     vector<SupportPoint>* grid;
-   	SupportStorage(){grid = nullptr;}
+
+    //Per grid cell the Z ranges that need support, stored flat. The ranges of cell n are ranges[rangeIndex[n]] up to ranges[rangeIndex[n+1]].
+    vector<int> rangeIndex;
+    vector<SupportRange> ranges;
+    //All the Z values where any cell starts or stops needing support, sorted. Between two of these the support area does not change.
+    vector<int32_t> rangeBreaks;
+
+    //The last generated support area, which is reused as long as the requested Z stays between the same rangeBreaks.
+    int cachedBand;
+    Polygons cachedPolygons;
+    vector<int> done;
+
+   	SupportStorage(){grid = nullptr; cachedBand = -1;}
 	  ~SupportStorage(){if(grid) delete [] grid;}
 };
 /******************/
@@ -69,6 +113,16 @@ public:
     vector<SliceLayer> layers;
 };
 
+//A copy of the model on the build plate, rotated around the object position and then moved by offset.
+class ModelInstance
+{
+public:
+    Point offset;
+    double rotation;
+
+    ModelInstance(Point offset, double rotation) : offset(offset), rotation(rotation) {}
+};
+
 class SliceDataStorage
 {
 public:
@@ -77,10 +131,15 @@ public:
     Polygons raftOutline;               //Storage for the outline of the raft. Will be filled with lines when the GCode is generated.
     vector<Polygons> oozeShield;        //oozeShield per layer
     vector<SliceVolumeStorage> volumes;
+    vector<LayerHeight> layerHeights;
     
     SupportStorage support;
     Polygons wipeTower;
     Point wipePoint;
+
+    //Copies of the model, see setModelInstances. The layer parts are kept once, where the model is, and moved to every instance when they are printed.
+    vector<ModelInstance> instances;
+    Point instanceCenter;
 };
 
 }//namespace cura
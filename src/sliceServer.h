@@ -0,0 +1,424 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#ifndef SLICE_SERVER_H
+#define SLICE_SERVER_H
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "utils/socket.h"
+#include "fffProcessor.h"
+
+#define SERVER_CMD_SETTING 0x01
+#define SERVER_CMD_MESH 0x02
+#define SERVER_CMD_SLICE 0x03
+#define SERVER_CMD_QUIT 0x04
+#define SERVER_CMD_MESH_SHARED_MEMORY 0x05
+
+#define SERVER_REPLY_PROGRESS 0x11
+#define SERVER_REPLY_GCODE 0x12
+#define SERVER_REPLY_FINISHED 0x13
+
+#define SERVER_MAX_STRING_LENGTH (16 * 1024 * 1024)
+#define SERVER_GCODE_CHUNK_SIZE (64 * 1024)
+
+//Rough memory use of a job, per model face and per face crossing of a layer (sliced segment, layer part and insets).
+#define SERVER_MEMORY_PER_FACE 256
+#define SERVER_MEMORY_PER_LAYER_CROSSING 512
+
+namespace cura {
+
+//A SliceJob is a model with its settings, the results are sent to the client that requested it.
+class SliceJob
+{
+public:
+    ConfigSettings config;
+    SimpleModel* model;
+    ClientSocket* client;
+    size_t memoryEstimate;
+    bool finished;
+
+    SliceJob(ConfigSettings& config, SimpleModel* model, ClientSocket* client)
+    : config(config), model(model), client(client), finished(false)
+    {
+        memoryEstimate = estimateMemory();
+    }
+
+    ~SliceJob()
+    {
+        delete model;
+    }
+
+    //Run the job and send the results. Called from a worker thread, each worker has its own infill cache.
+    void run(InfillCache& infillCache)
+    {
+        PrintResult result;
+        memset(&result, 0, sizeof(result));
+        bool success = false;
+        FILE* file = tmpfile();
+        if (file == nullptr)
+        {
+            cLogError("Failed to create a temporary file for the G-code.\n");
+        }
+        else if (model->volumes.size() < 1)
+        {
+            cLogError("Slice requested without a mesh.\n");
+            fclose(file);
+        }
+        else
+        {
+            //The processor owns the file, the G-code has to be sent before the processor is destroyed.
+            fffProcessor processor(config, &infillCache);
+            processor.setTargetStream(file);
+            setProgressCallback(sendProgress, client);
+            try {
+                success = processor.processModel(model);
+            }catch(...){
+                cLogError("Unknown exception\n");
+            }
+            model = nullptr;
+            if (success)
+            {
+                processor.finalize();
+                result = processor.getPrintResult();
+            }
+            setProgressCallback(nullptr, nullptr);
+            if (success)
+                sendGCode(file);
+        }
+
+        client->sendNr(SERVER_REPLY_FINISHED);
+        client->sendNr(success ? 1 : 0);
+        client->sendNr(int(result.printTime));
+        client->sendNr(result.layerCount);
+        client->sendNr(MAX_EXTRUDERS);
+        for(unsigned int e=0; e<MAX_EXTRUDERS; e++)
+        {
+            float filament = result.filamentUsed[e];
+            client->sendAll(&filament, sizeof(float));
+        }
+    }
+
+private:
+    //Memory use grows with the number of faces and with the number of layers every face is sliced at.
+    size_t estimateMemory()
+    {
+        int layerThickness = config.layerThickness;
+        if (config.adaptiveLayerCuspHeight > 0)
+            layerThickness = std::min(layerThickness, config.adaptiveLayerMinThickness);
+        layerThickness = std::max(layerThickness, 1);
+        size_t memory = 0;
+        for(unsigned int v=0; v<model->volumes.size(); v++)
+        {
+            std::vector<SimpleFace>& faces = model->volumes[v].faces;
+            for(unsigned int n=0; n<faces.size(); n++)
+            {
+                int32_t zMin = std::min(faces[n].v[0].z, std::min(faces[n].v[1].z, faces[n].v[2].z));
+                int32_t zMax = std::max(faces[n].v[0].z, std::max(faces[n].v[1].z, faces[n].v[2].z));
+                memory += SERVER_MEMORY_PER_FACE + size_t((zMax - zMin) / layerThickness + 1) * SERVER_MEMORY_PER_LAYER_CROSSING;
+            }
+        }
+        return memory;
+    }
+
+    static void sendProgress(void* data, const char* type, int value, int maxValue)
+    {
+        ClientSocket* client = static_cast<ClientSocket*>(data);
+        int length = strlen(type);
+        client->sendNr(SERVER_REPLY_PROGRESS);
+        client->sendNr(length);
+        client->sendAll(type, length);
+        client->sendNr(value);
+        client->sendNr(maxValue);
+    }
+
+    void sendGCode(FILE* file)
+    {
+        fflush(file);
+        rewind(file);
+        std::vector<char> buffer(SERVER_GCODE_CHUNK_SIZE);
+        while(client->isConnected())
+        {
+            int length = fread(buffer.data(), 1, buffer.size(), file);
+            if (length <= 0)
+                break;
+            client->sendNr(SERVER_REPLY_GCODE);
+            client->sendNr(length);
+            client->sendAll(buffer.data(), length);
+        }
+    }
+};
+
+/**
+    The SliceScheduler runs the jobs of all connections on a fixed set of worker threads, in the order they are submitted.
+    A job is only started when its memory estimate fits in what is left of the memory budget, a job that is larger
+    than the whole budget runs when nothing else is running. Jobs are started in order, so a large job is not starved by small ones.
+*/
+class SliceScheduler
+{
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<SliceJob*> queue;
+    std::vector<std::thread> workers;
+    size_t memoryBudget;
+    size_t memoryInUse;
+    bool stopping;
+
+public:
+    SliceScheduler(int workerCount, size_t memoryBudget)
+    : memoryBudget(memoryBudget), memoryInUse(0), stopping(false)
+    {
+        if (workerCount < 1)
+            workerCount = std::max(1u, std::thread::hardware_concurrency());
+        for(int n=0; n<workerCount; n++)
+            workers.push_back(std::thread(&SliceScheduler::workerMain, this, workerCount));
+    }
+
+    ~SliceScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for(unsigned int n=0; n<workers.size(); n++)
+            workers[n].join();
+    }
+
+    //Queue the job and wait till it is finished.
+    void run(SliceJob* job)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        queue.push_back(job);
+        changed.notify_all();
+        changed.wait(lock, [job]() { return job->finished; });
+    }
+
+private:
+    bool canStart(SliceJob* job)
+    {
+        return memoryBudget == 0 || memoryInUse == 0 || memoryInUse + job->memoryEstimate <= memoryBudget;
+    }
+
+    void workerMain(int workerCount)
+    {
+#ifdef _OPENMP
+        //The parallel loops inside a job share the cores with the other workers.
+        omp_set_num_threads(std::max(1, omp_get_num_procs() / workerCount));
+#else
+        (void)workerCount;
+#endif
+        InfillCache infillCache;
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            changed.wait(lock, [this]() { return stopping || (!queue.empty() && canStart(queue.front())); });
+            if (stopping)
+                return;
+            SliceJob* job = queue.front();
+            queue.pop_front();
+            memoryInUse += job->memoryEstimate;
+            lock.unlock();
+
+            job->run(infillCache);
+
+            lock.lock();
+            memoryInUse -= job->memoryEstimate;
+            job->finished = true;
+            changed.notify_all();
+        }
+    }
+};
+
+/**
+    The SliceServer keeps the engine running and slices the jobs sent to it over local TCP connections.
+    This saves the process startup and config parsing for every job, and keeps caches warm between jobs.
+    Every connection is handled by its own thread, the jobs of all connections are sliced by a shared SliceScheduler.
+
+    All numbers are 32 bit integers in host byte order, just like the GUI socket.
+    Requests from the client:
+      SETTING <keyLength> <key> <valueLength> <value>   Change a setting of the next job. Every job starts with the settings of the server.
+      MESH <vertexCount> <vertexCount * 3 floats>       Add a volume to the next job, every 3 vertexes are a face.
+      MESH_SHARED_MEMORY <nameLength> <name>            Add the volumes in shared memory ("shm:<name>") to the next job, see loadModelSharedMemory
+                                                        for the layout. "fd:<number>" is refused, a descriptor cannot be passed over TCP.
+      SLICE                                             Slice the job, the next request is handled when the job is finished.
+      QUIT                                              Stop accepting connections, the server exits when all connections are closed.
+    Replies to SLICE:
+      PROGRESS <typeLength> <type> <value> <maxValue>   Zero or more progress reports.
+      GCODE <length> <data>                             The G-code, in one or more chunks.
+      FINISHED <success> <printTime> <layerCount> <extruderCount> <extruderCount floats of filament used>
+*/
+class SliceServer
+{
+private:
+    //The thread handling a single client, which is joined once the client is done.
+    class Connection
+    {
+    public:
+        ClientSocket* client;
+        std::thread thread;
+        std::atomic<bool> done;
+
+        Connection(ClientSocket* client) : client(client), done(false) {}
+    };
+
+    ConfigSettings& baseConfig;
+    ServerSocket server;
+    SliceScheduler scheduler;
+    std::vector<Connection*> connections;
+
+public:
+    SliceServer(ConfigSettings& baseConfig)
+    : baseConfig(baseConfig), scheduler(baseConfig.serverWorkerCount, size_t(std::max(baseConfig.serverMemoryBudget, 0)) * 1024 * 1024)
+    {
+    }
+
+    bool run(int port)
+    {
+        if (!server.listenOn(port))
+            return false;
+        cLog("Waiting for slice jobs on port %d\n", port);
+        while(true)
+        {
+            ClientSocket* client = new ClientSocket();
+            if (!server.acceptClient(*client))
+            {
+                delete client;
+                break;
+            }
+            reapConnections(false);
+            Connection* connection = new Connection(client);
+            connection->thread = std::thread(&SliceServer::handleClient, this, connection);
+            connections.push_back(connection);
+        }
+        reapConnections(true);
+        server.close();
+        return true;
+    }
+
+private:
+    //Join the threads of the clients that are done, or of all clients when waitForAll is set, so a long running server does not keep a thread for every client it ever served.
+    void reapConnections(bool waitForAll)
+    {
+        for(unsigned int n=0; n<connections.size(); n++)
+        {
+            if (!waitForAll && !connections[n]->done)
+                continue;
+            connections[n]->thread.join();
+            delete connections[n];
+            connections.erase(connections.begin() + n);
+            n--;
+        }
+    }
+
+    void handleClient(Connection* connection)
+    {
+        ClientSocket* client = connection->client;
+        ConfigSettings jobConfig(baseConfig);
+        SimpleModel* model = new SimpleModel();
+        while(true)
+        {
+            int command = client->recvNr();
+            if (!client->isConnected())
+                break;
+            if (command == SERVER_CMD_SETTING)
+            {
+                receiveSetting(client, jobConfig);
+            }else if (command == SERVER_CMD_MESH)
+            {
+                receiveMesh(client, jobConfig, model);
+            }else if (command == SERVER_CMD_MESH_SHARED_MEMORY)
+            {
+                receiveSharedMemoryMesh(client, jobConfig, model);
+            }else if (command == SERVER_CMD_SLICE)
+            {
+                SliceJob job(jobConfig, model, client);
+                scheduler.run(&job);
+                jobConfig = baseConfig;
+                model = new SimpleModel();
+            }else if (command == SERVER_CMD_QUIT)
+            {
+                server.stopListening();
+                break;
+            }else{
+                cLogError("Unknown slice server command: %d\n", command);
+                break;
+            }
+        }
+        delete model;
+        delete client;
+        connection->done = true;
+    }
+
+    static bool receiveString(ClientSocket* client, std::string& str)
+    {
+        int length = client->recvNr();
+        if (length < 0 || length > SERVER_MAX_STRING_LENGTH)
+        {
+            client->close();
+            return false;
+        }
+        str.resize(length);
+        if (length > 0)
+            client->recvAll(&str[0], length);
+        return client->isConnected();
+    }
+
+    static void receiveSetting(ClientSocket* client, ConfigSettings& jobConfig)
+    {
+        std::string key, value;
+        if (!receiveString(client, key) || !receiveString(client, value))
+            return;
+        if (!jobConfig.setSetting(key.c_str(), value.c_str()))
+            cLogError("Setting not found: %s %s\n", key.c_str(), value.c_str());
+    }
+
+    static void receiveMesh(ClientSocket* client, ConfigSettings& jobConfig, SimpleModel* model)
+    {
+        int32_t vertexCount = client->recvNr();
+        if (vertexCount < 0)
+        {
+            client->close();
+            return;
+        }
+        model->volumes.push_back(SimpleVolume());
+        SimpleVolume* volume = &model->volumes[model->volumes.size()-1];
+        cLog("Reading mesh from client with %i vertexes\n", vertexCount);
+        std::vector<float> vertexes;
+        while(vertexCount > 0 && client->isConnected())
+        {
+            int batch = std::min(vertexCount, MESH_VERTEX_BATCH_SIZE);
+            vertexes.resize(batch * 3);
+            client->recvAll(vertexes.data(), batch * 3 * sizeof(float));
+            addFacesFromVertexes(volume, vertexes.data(), batch, jobConfig.matrix);
+            vertexCount -= batch;
+        }
+    }
+
+    static void receiveSharedMemoryMesh(ClientSocket* client, ConfigSettings& jobConfig, SimpleModel* model)
+    {
+        std::string name;
+        if (!receiveString(client, name))
+            return;
+        //A descriptor number from a client would name one of the descriptors of the server itself, like the socket or the tmpfile of another job.
+        if (strncmp(name.c_str(), "shm:", 4) != 0)
+        {
+            cLogError("Only shm: shared memory meshes are accepted by the slice server: %s\n", name.c_str());
+            return;
+        }
+        if (!loadModelSharedMemory(model, name.c_str(), jobConfig.matrix))
+            cLogError("Failed to load shared memory mesh: %s\n", name.c_str());
+    }
+};
+
+}//namespace cura
+
+#endif//SLICE_SERVER_H
@@ -1,5 +1,7 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include <stdio.h>
+#include <math.h>
+#include <algorithm>
 
 #include "utils/gettime.h"
 #include "utils/logoutput.h"
@@ -9,7 +11,7 @@
 
 namespace cura {
 
-void SlicerLayer::makePolygons(OptimizedVolume* ov, bool keepNoneClosed, bool extensiveStitching)
+void SlicerLayer::makePolygons(OptimizedVolume* ov, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance)
 {
     Polygons openPolygonList;
     
@@ -297,24 +299,46 @@ void SlicerLayer::makePolygons(OptimizedVolume* ov, bool keepNoneClosed, bool ex
     }
 
     //Finally optimize all the polygons. Every point removed saves time in the long run.
-    optimizePolygons(polygonList);
+    optimizePolygons(polygonList, simplifyTolerance);
 }
 
 
-Slicer::Slicer(OptimizedVolume* ov, int32_t initial, int32_t thickness, bool keepNoneClosed, bool extensiveStitching)
+Slicer::Slicer(OptimizedVolume* ov, const std::vector<LayerHeight>& layerHeights, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance)
 {
     modelSize = ov->model->modelSize;
     modelMin = ov->model->vMin;
     
-    int layerCount = (modelSize.z - initial) / thickness + 1;
-    cLog("Layer count: %i\n", layerCount);
-    layers.resize(layerCount);
-    
-    for(int32_t layerNr = 0; layerNr < layerCount; layerNr++)
+    cLog("Layer count: %i\n", int(layerHeights.size()));
+    setLayerHeights(layerHeights);
+    sliceLayers(ov, layerHeights, 0, layerHeights.size(), keepNoneClosed, extensiveStitching, simplifyTolerance);
+}
+
+Slicer::Slicer(OptimizedVolume* ov, const std::vector<LayerHeight>& layerHeights, int firstLayerNr, int lastLayerNr, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance)
+{
+    modelSize = ov->model->modelSize;
+    modelMin = ov->model->vMin;
+
+    setLayerHeights(layerHeights);
+    sliceLayers(ov, layerHeights, firstLayerNr, lastLayerNr, keepNoneClosed, extensiveStitching, simplifyTolerance);
+}
+
+Slicer::Slicer(const std::vector<LayerHeight>& layerHeights, Point3 modelSize, Point3 modelMin)
+: modelSize(modelSize), modelMin(modelMin)
+{
+    setLayerHeights(layerHeights);
+}
+
+void Slicer::setLayerHeights(const std::vector<LayerHeight>& layerHeights)
+{
+    layers.resize(layerHeights.size());
+    for(unsigned int layerNr = 0; layerNr < layers.size(); layerNr++)
     {
-        layers[layerNr].z = initial + thickness * layerNr;
+        layers[layerNr].z = layerHeights[layerNr].sliceZ;
     }
-    
+}
+
+void Slicer::sliceLayers(OptimizedVolume* ov, const std::vector<LayerHeight>& layerHeights, int firstLayerNr, int lastLayerNr, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance)
+{
     for(unsigned int i=0; i<ov->faces.size(); i++)
     {
         Point3 p0 = ov->points[ov->faces[i].index[0]].p;
@@ -327,11 +351,10 @@ Slicer::Slicer(OptimizedVolume* ov, int32_t initial, int32_t thickness, bool kee
         if (p1.z > maxZ) maxZ = p1.z;
         if (p2.z > maxZ) maxZ = p2.z;
         
-        for(int32_t layerNr = (minZ - initial) / thickness; layerNr <= (maxZ - initial) / thickness; layerNr++)
+        int32_t layerNr = std::lower_bound(layerHeights.begin() + firstLayerNr, layerHeights.begin() + lastLayerNr, minZ, [](const LayerHeight& h, int32_t z) { return h.sliceZ < z; }) - layerHeights.begin();
+        for(; layerNr < lastLayerNr && layers[layerNr].z <= maxZ; layerNr++)
         {
-            int32_t z = layerNr * thickness + initial;
-            if (z < minZ) continue;
-            if (layerNr < 0) continue;
+            int32_t z = layers[layerNr].z;
             
             SlicerSegment s;
             if (p0.z < z && p1.z >= z && p2.z >= z)
@@ -361,10 +384,93 @@ Slicer::Slicer(OptimizedVolume* ov, int32_t initial, int32_t thickness, bool kee
         }
     }
     
-    for(unsigned int layerNr=0; layerNr<layers.size(); layerNr++)
+    for(int layerNr=firstLayerNr; layerNr<lastLayerNr; layerNr++)
+    {
+        layers[layerNr].makePolygons(ov, keepNoneClosed, extensiveStitching, simplifyTolerance);
+    }
+}
+
+LayerHeightCalculator::LayerHeightCalculator(int32_t modelHeight, int initialLayerThickness, int layerThickness, int cuspHeight, int minThickness, int maxThickness)
+: modelHeight(modelHeight), initialLayerThickness(initialLayerThickness), layerThickness(layerThickness), cuspHeight(cuspHeight)
+{
+    this->minThickness = std::max(minThickness, 1);
+    this->maxThickness = std::max(maxThickness, this->minThickness);
+    binSize = std::max(this->minThickness / 2, 1);
+    if (cuspHeight > 0)
+        binLimit.resize(std::max(modelHeight, 0) / binSize + 1, this->maxThickness);
+}
+
+void LayerHeightCalculator::addFace(Point3& p0, Point3& p1, Point3& p2)
+{
+    if (cuspHeight <= 0)
+        return;
+    int32_t minZ = std::min(p0.z, std::min(p1.z, p2.z));
+    int32_t maxZ = std::max(p0.z, std::max(p1.z, p2.z));
+    if (minZ == maxZ)
+    {
+        flatZ.push_back(minZ);
+        return;
+    }
+    double ax = p1.x - p0.x, ay = p1.y - p0.y, az = p1.z - p0.z;
+    double bx = p2.x - p0.x, by = p2.y - p0.y, bz = p2.z - p0.z;
+    double nx = ay * bz - az * by, ny = az * bx - ax * bz, nz = ax * by - ay * bx;
+    double length = sqrt(nx * nx + ny * ny + nz * nz);
+    if (length <= 0.0)
+        return;
+    //A layer of thickness h leaves a step of h * |nz| on the surface of this face.
+    double slope = fabs(nz) / length;
+    if (slope * maxThickness <= cuspHeight)
+        return;
+    int32_t limit = cuspHeight / slope;
+    int binCount = binLimit.size();
+    for(int bin = std::max(minZ, 0) / binSize; bin <= std::min(maxZ / binSize, binCount - 1); bin++)
+        binLimit[bin] = std::min(binLimit[bin], limit);
+}
+
+void LayerHeightCalculator::calculate(std::vector<LayerHeight>& layerHeights)
+{
+    layerHeights.clear();
+    //The first layer is sliced half a normal layer below its top, so it catches the bottom of the model.
+    int32_t initialSliceZ = initialLayerThickness - layerThickness / 2;
+    if (cuspHeight <= 0)
+    {
+        int layerCount = (modelHeight - initialSliceZ) / layerThickness + 1;
+        for(int layerNr = 0; layerNr < layerCount; layerNr++)
+            layerHeights.push_back(LayerHeight(initialSliceZ + layerThickness * layerNr, initialLayerThickness + layerThickness * layerNr, layerNr == 0 ? initialLayerThickness : layerThickness));
+        return;
+    }
+    std::sort(flatZ.begin(), flatZ.end());
+
+    int binCount = binLimit.size();
+    layerHeights.push_back(LayerHeight(initialSliceZ, initialLayerThickness, initialLayerThickness));
+    int32_t z = initialLayerThickness;
+    while(modelHeight - z >= minThickness / 2)
+    {
+        int32_t thickness = maxThickness;
+        for(int bin = z / binSize; bin < binCount && bin * binSize < z + thickness; bin++)
+            thickness = std::min(thickness, binLimit[bin]);
+        thickness = std::max(thickness, minThickness);
+        //End the layer on the next flat surface when it is inside this layer, so the surface is printed at its exact height.
+        std::vector<int32_t>::iterator flat = std::lower_bound(flatZ.begin(), flatZ.end(), z + minThickness);
+        if (flat != flatZ.end() && *flat < z + thickness)
+            thickness = *flat - z;
+        if (z + thickness > modelHeight && modelHeight - z >= minThickness)
+            thickness = modelHeight - z;
+        z += thickness;
+        layerHeights.push_back(LayerHeight(z - thickness / 2, z, thickness));
+    }
+}
+
+void calculateLayerHeights(OptimizedModel* model, int initialLayerThickness, int layerThickness, int cuspHeight, int minThickness, int maxThickness, std::vector<LayerHeight>& layerHeights)
+{
+    LayerHeightCalculator calculator(model->modelSize.z, initialLayerThickness, layerThickness, cuspHeight, minThickness, maxThickness);
+    for(unsigned int v=0; v<model->volumes.size() && cuspHeight > 0; v++)
     {
-        layers[layerNr].makePolygons(ov, keepNoneClosed, extensiveStitching);
+        OptimizedVolume* ov = &model->volumes[v];
+        for(unsigned int i=0; i<ov->faces.size(); i++)
+            calculator.addFace(ov->points[ov->faces[i].index[0]].p, ov->points[ov->faces[i].index[1]].p, ov->points[ov->faces[i].index[2]].p);
     }
+    calculator.calculate(layerHeights);
 }
 
 void Slicer::dumpSegmentsToHTML(const char* filename)
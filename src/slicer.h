@@ -3,6 +3,7 @@
 #define SLICER_H
 
 #include "optimizedModel.h"
+#include "sliceDataStorage.h"
 #include "utils/polygon.h"
 /*
     The Slicer creates layers of polygons from an optimized 3D model.
@@ -46,7 +47,7 @@ public:
     Polygons polygonList;
     Polygons openPolygons;
     
-    void makePolygons(OptimizedVolume* ov, bool keepNoneClosed, bool extensiveStitching);
+    void makePolygons(OptimizedVolume* ov, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance);
 
 private:
     gapCloserResult findPolygonGapCloser(Point ip0, Point ip1)
@@ -144,7 +145,11 @@ public:
     std::vector<SlicerLayer> layers;
     Point3 modelSize, modelMin;
     
-    Slicer(OptimizedVolume* ov, int32_t initial, int32_t thickness, bool keepNoneClosed, bool extensiveStitching);
+    Slicer(OptimizedVolume* ov, const std::vector<LayerHeight>& layerHeights, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance);
+    //Only slice the layers from firstLayerNr up to lastLayerNr, the other layers stay empty. Used to slice a model band by band.
+    Slicer(OptimizedVolume* ov, const std::vector<LayerHeight>& layerHeights, int firstLayerNr, int lastLayerNr, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance);
+    //A slicer without any slices yet, for the layers of the bands to be moved into.
+    Slicer(const std::vector<LayerHeight>& layerHeights, Point3 modelSize, Point3 modelMin);
     
     SlicerSegment project2D(Point3& p0, Point3& p1, Point3& p2, int32_t z) const
     {
@@ -157,8 +162,37 @@ public:
     }
     
     void dumpSegmentsToHTML(const char* filename);
+
+private:
+    void setLayerHeights(const std::vector<LayerHeight>& layerHeights);
+    void sliceLayers(OptimizedVolume* ov, const std::vector<LayerHeight>& layerHeights, int firstLayerNr, int lastLayerNr, bool keepNoneClosed, bool extensiveStitching, int simplifyTolerance);
+};
+
+//Collects the slopes and flat surfaces of the faces of a model one by one, to calculate the layer heights from. See calculateLayerHeights.
+class LayerHeightCalculator
+{
+public:
+    LayerHeightCalculator(int32_t modelHeight, int initialLayerThickness, int layerThickness, int cuspHeight, int minThickness, int maxThickness);
+
+    void addFace(Point3& p0, Point3& p1, Point3& p2);
+    void calculate(std::vector<LayerHeight>& layerHeights);
+
+private:
+    int32_t modelHeight;
+    int initialLayerThickness, layerThickness, cuspHeight, minThickness, maxThickness;
+    //Per bin of height the thickest layer allowed by the faces that cross that height, and the heights of all the flat faces.
+    int32_t binSize;
+    std::vector<int32_t> binLimit;
+    std::vector<int32_t> flatZ;
 };
 
+/*
+    Calculate the Z of every layer. With a cuspHeight of 0 all layers after the first are layerThickness thick.
+    Otherwise the thickness follows the slope of the surface: the step between two layers on a sloped surface stays below cuspHeight,
+    so layers are thin on shallow slopes and up to maxThickness thick on vertical walls. Layers also end exactly on flat surfaces.
+*/
+void calculateLayerHeights(OptimizedModel* model, int initialLayerThickness, int layerThickness, int cuspHeight, int minThickness, int maxThickness, std::vector<LayerHeight>& layerHeights);
+
 }//namespace cura
 
 #endif//SLICER_H
@@ -1,4 +1,7 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#include <algorithm>
+#include <limits>
+
 #include "support.h"
 
 namespace cura {
@@ -16,73 +19,85 @@ int cmp_SupportPoint(const void* a, const void* b)
 }
 
 void generateSupportGrid(SupportStorage& storage, OptimizedModel* om, int supportAngle, bool supportEverywhere, int supportXYDistance, int supportZDistance)
+{
+    startSupportGrid(storage, om->vMin, om->modelSize, supportAngle, supportEverywhere, supportXYDistance, supportZDistance);
+    if (!storage.generated)
+        return;
+
+    for(unsigned int volumeIdx = 0; volumeIdx < om->volumes.size(); volumeIdx++)
+    {
+        OptimizedVolume* vol = &om->volumes[volumeIdx];
+        for(unsigned int faceIdx = 0; faceIdx < vol->faces.size(); faceIdx++)
+        {
+            OptimizedFace* face = &vol->faces[faceIdx];
+            addSupportFace(storage, vol->points[face->index[0]].p, vol->points[face->index[1]].p, vol->points[face->index[2]].p);
+        }
+    }
+    finishSupportGrid(storage);
+}
+
+void startSupportGrid(SupportStorage& storage, Point3 modelMin, Point3 modelSize, int supportAngle, bool supportEverywhere, int supportXYDistance, int supportZDistance)
 {
     storage.generated = false;
     if (supportAngle < 0)
         return;
     storage.generated = true;
     
-    storage.gridOffset.X = om->vMin.x;
-    storage.gridOffset.Y = om->vMin.y;
+    storage.gridOffset.X = modelMin.x;
+    storage.gridOffset.Y = modelMin.y;
     storage.gridScale = 200;
-    storage.gridWidth = (om->modelSize.x / storage.gridScale) + 1;
-    storage.gridHeight = (om->modelSize.y / storage.gridScale) + 1;
+    storage.gridWidth = (modelSize.x / storage.gridScale) + 1;
+    storage.gridHeight = (modelSize.y / storage.gridScale) + 1;
     storage.grid = new vector<SupportPoint>[storage.gridWidth * storage.gridHeight];
     storage.angle = supportAngle;
     storage.everywhere = supportEverywhere;
     storage.XYDistance = supportXYDistance;
     storage.ZDistance = supportZDistance;
+}
 
-    for(unsigned int volumeIdx = 0; volumeIdx < om->volumes.size(); volumeIdx++)
+void addSupportFace(SupportStorage& storage, Point3 v0, Point3 v1, Point3 v2)
+{
+    Point3 normal = (v1 - v0).cross(v2 - v0);
+    int32_t normalSize = normal.vSize();
+    
+    double cosAngle = fabs(double(normal.z) / double(normalSize));
+    
+    v0.x = (v0.x - storage.gridOffset.X) / storage.gridScale;
+    v0.y = (v0.y - storage.gridOffset.Y) / storage.gridScale;
+    v1.x = (v1.x - storage.gridOffset.X) / storage.gridScale;
+    v1.y = (v1.y - storage.gridOffset.Y) / storage.gridScale;
+    v2.x = (v2.x - storage.gridOffset.X) / storage.gridScale;
+    v2.y = (v2.y - storage.gridOffset.Y) / storage.gridScale;
+
+    if (v0.x > v1.x) swap(v0, v1);
+    if (v1.x > v2.x) swap(v1, v2);
+    if (v0.x > v1.x) swap(v0, v1);
+    for(int64_t x=v0.x; x<v1.x; x++)
     {
-        OptimizedVolume* vol = &om->volumes[volumeIdx];
-        for(unsigned int faceIdx = 0; faceIdx < vol->faces.size(); faceIdx++)
-        {
-            OptimizedFace* face = &vol->faces[faceIdx];
-            Point3 v0 = vol->points[face->index[0]].p;
-            Point3 v1 = vol->points[face->index[1]].p;
-            Point3 v2 = vol->points[face->index[2]].p;
-            
-            Point3 normal = (v1 - v0).cross(v2 - v0);
-            int32_t normalSize = normal.vSize();
-            
-            double cosAngle = fabs(double(normal.z) / double(normalSize));
-            
-            v0.x = (v0.x - storage.gridOffset.X) / storage.gridScale;
-            v0.y = (v0.y - storage.gridOffset.Y) / storage.gridScale;
-            v1.x = (v1.x - storage.gridOffset.X) / storage.gridScale;
-            v1.y = (v1.y - storage.gridOffset.Y) / storage.gridScale;
-            v2.x = (v2.x - storage.gridOffset.X) / storage.gridScale;
-            v2.y = (v2.y - storage.gridOffset.Y) / storage.gridScale;
-
-            if (v0.x > v1.x) swap(v0, v1);
-            if (v1.x > v2.x) swap(v1, v2);
-            if (v0.x > v1.x) swap(v0, v1);
-            for(int64_t x=v0.x; x<v1.x; x++)
-            {
-                int64_t y0 = v0.y + (v1.y - v0.y) * (x - v0.x) / (v1.x - v0.x);
-                int64_t y1 = v0.y + (v2.y - v0.y) * (x - v0.x) / (v2.x - v0.x);
-                int64_t z0 = v0.z + (v1.z - v0.z) * (x - v0.x) / (v1.x - v0.x);
-                int64_t z1 = v0.z + (v2.z - v0.z) * (x - v0.x) / (v2.x - v0.x);
-
-                if (y0 > y1) { swap(y0, y1); swap(z0, z1); }
-                for(int64_t y=y0; y<y1; y++)
-                    storage.grid[x+y*storage.gridWidth].push_back(SupportPoint(z0 + (z1 - z0) * (y-y0) / (y1-y0), cosAngle));
-            }
-            for(int64_t x=v1.x; x<v2.x; x++)
-            {
-                int64_t y0 = v1.y + (v2.y - v1.y) * (x - v1.x) / (v2.x - v1.x);
-                int64_t y1 = v0.y + (v2.y - v0.y) * (x - v0.x) / (v2.x - v0.x);
-                int64_t z0 = v1.z + (v2.z - v1.z) * (x - v1.x) / (v2.x - v1.x);
-                int64_t z1 = v0.z + (v2.z - v0.z) * (x - v0.x) / (v2.x - v0.x);
-
-                if (y0 > y1) { swap(y0, y1); swap(z0, z1); }
-                for(int64_t y=y0; y<y1; y++)
-                    storage.grid[x+y*storage.gridWidth].push_back(SupportPoint(z0 + (z1 - z0) * (y-y0) / (y1-y0), cosAngle));
-            }
-        }
+        int64_t y0 = v0.y + (v1.y - v0.y) * (x - v0.x) / (v1.x - v0.x);
+        int64_t y1 = v0.y + (v2.y - v0.y) * (x - v0.x) / (v2.x - v0.x);
+        int64_t z0 = v0.z + (v1.z - v0.z) * (x - v0.x) / (v1.x - v0.x);
+        int64_t z1 = v0.z + (v2.z - v0.z) * (x - v0.x) / (v2.x - v0.x);
+
+        if (y0 > y1) { swap(y0, y1); swap(z0, z1); }
+        for(int64_t y=y0; y<y1; y++)
+            storage.grid[x+y*storage.gridWidth].push_back(SupportPoint(z0 + (z1 - z0) * (y-y0) / (y1-y0), cosAngle));
     }
-    
+    for(int64_t x=v1.x; x<v2.x; x++)
+    {
+        int64_t y0 = v1.y + (v2.y - v1.y) * (x - v1.x) / (v2.x - v1.x);
+        int64_t y1 = v0.y + (v2.y - v0.y) * (x - v0.x) / (v2.x - v0.x);
+        int64_t z0 = v1.z + (v2.z - v1.z) * (x - v1.x) / (v2.x - v1.x);
+        int64_t z1 = v0.z + (v2.z - v0.z) * (x - v0.x) / (v2.x - v0.x);
+
+        if (y0 > y1) { swap(y0, y1); swap(z0, z1); }
+        for(int64_t y=y0; y<y1; y++)
+            storage.grid[x+y*storage.gridWidth].push_back(SupportPoint(z0 + (z1 - z0) * (y-y0) / (y1-y0), cosAngle));
+    }
+}
+
+void finishSupportGrid(SupportStorage& storage)
+{
     for(int32_t x=0; x<storage.gridWidth; x++)
     {
         for(int32_t y=0; y<storage.gridHeight; y++)
@@ -93,6 +108,52 @@ void generateSupportGrid(SupportStorage& storage, OptimizedModel* om, int suppor
     }
     storage.gridOffset.X += storage.gridScale / 2;
     storage.gridOffset.Y += storage.gridScale / 2;
+
+    generateSupportRanges(storage);
+}
+
+void generateSupportRanges(SupportStorage& storage)
+{
+    //Precompute for each cell in which Z ranges support is needed, so generating a support layer becomes a lookup
+    // instead of walking the sorted support points of every cell for every layer.
+    storage.cosAngle = cos(double(90 - storage.angle) / 180.0 * M_PI) - 0.01;
+    storage.rangeIndex.clear();
+    storage.ranges.clear();
+    storage.rangeBreaks.clear();
+    storage.cachedBand = -1;
+    storage.cachedPolygons.clear();
+
+    const int32_t noLowerLimit = std::numeric_limits<int32_t>::min();
+    for(int32_t n=0; n<storage.gridWidth * storage.gridHeight; n++)
+    {
+        storage.rangeIndex.push_back(storage.ranges.size());
+        vector<SupportPoint>& cell = storage.grid[n];
+        if (storage.everywhere)
+        {
+            for(unsigned int i=0; i<cell.size(); i+=2)
+            {
+                if (cell[i].cosAngle < storage.cosAngle)
+                    continue;
+                int32_t zLow = (i == 0) ? noLowerLimit : cell[i-1].z + storage.ZDistance;
+                int32_t zHigh = cell[i].z - storage.ZDistance;
+                if (zLow < zHigh)
+                    storage.ranges.push_back(SupportRange(zLow, zHigh));
+            }
+        }else{
+            if (cell.size() > 0 && cell[0].cosAngle >= storage.cosAngle)
+                storage.ranges.push_back(SupportRange(noLowerLimit, cell[0].z - storage.ZDistance));
+        }
+    }
+    storage.rangeIndex.push_back(storage.ranges.size());
+
+    for(unsigned int i=0; i<storage.ranges.size(); i++)
+    {
+        if (storage.ranges[i].zLow != noLowerLimit)
+            storage.rangeBreaks.push_back(storage.ranges[i].zLow);
+        storage.rangeBreaks.push_back(storage.ranges[i].zHigh);
+    }
+    std::sort(storage.rangeBreaks.begin(), storage.rangeBreaks.end());
+    storage.rangeBreaks.erase(std::unique(storage.rangeBreaks.begin(), storage.rangeBreaks.end()), storage.rangeBreaks.end());
 }
 
 bool SupportPolyGenerator::needSupportAt(Point p)
@@ -104,31 +165,17 @@ bool SupportPolyGenerator::needSupportAt(Point p)
     if (done[p.X + p.Y * storage.gridWidth]) return false;
     
     unsigned int n = p.X+p.Y*storage.gridWidth;
-    
-    if (everywhere)
+    for(int i=storage.rangeIndex[n]; i<storage.rangeIndex[n+1]; i++)
     {
-        bool ok = false;
-        for(unsigned int i=0; i<storage.grid[n].size(); i+=2)
-        {
-            if (storage.grid[n][i].cosAngle >= cosAngle && storage.grid[n][i].z - supportZDistance >= z && (i == 0 || storage.grid[n][i-1].z + supportZDistance < z))
-            {
-                ok = true;
-                break;
-            }
-        }
-        if (!ok) return false;
-    }else{
-        if (storage.grid[n].size() < 1) return false;
-        if (storage.grid[n][0].cosAngle < cosAngle) return false;
-        if (storage.grid[n][0].z - supportZDistance < z) return false;
+        if (storage.ranges[i].zLow < z && z <= storage.ranges[i].zHigh)
+            return true;
     }
-    return true;
+    return false;
 }
 
 void SupportPolyGenerator::lazyFill(Point startPoint)
 {
-    static int nr = 0;
-    nr++;
+    int nr = ++fillNr;
     PolygonRef poly = polygons.newPoly();
     Polygon tmpPoly;
 
@@ -161,16 +208,21 @@ void SupportPolyGenerator::lazyFill(Point startPoint)
 }
     
 SupportPolyGenerator::SupportPolyGenerator(SupportStorage& storage, int32_t z)
-: storage(storage), z(z), everywhere(storage.everywhere)
+: storage(storage), z(z), fillNr(0)
 {
     if (!storage.generated)
         return;
-    
-    cosAngle = cos(double(90 - storage.angle) / 180.0 * M_PI) - 0.01;
-    this->supportZDistance = storage.ZDistance;
 
-    done = new int[storage.gridWidth*storage.gridHeight];
-    memset(done, 0, sizeof(int) * storage.gridWidth*storage.gridHeight);
+    //Which cells need support only changes at the rangeBreaks, so if we are in the same band as the previous request we can reuse its result.
+    int band = std::lower_bound(storage.rangeBreaks.begin(), storage.rangeBreaks.end(), z) - storage.rangeBreaks.begin();
+    if (band == storage.cachedBand)
+    {
+        polygons = storage.cachedPolygons;
+        return;
+    }
+
+    storage.done.assign(storage.gridWidth*storage.gridHeight, 0);
+    done = storage.done.data();
     
     for(int32_t y=1; y<storage.gridHeight; y++)
     {
@@ -181,10 +233,11 @@ SupportPolyGenerator::SupportPolyGenerator(SupportStorage& storage, int32_t z)
             lazyFill(Point(x, y));
         }
     }
-
-    delete[] done;
     
     polygons = polygons.offset(storage.XYDistance);
+
+    storage.cachedBand = band;
+    storage.cachedPolygons = polygons;
 }
 
 }//namespace cura
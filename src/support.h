@@ -8,6 +8,11 @@
 namespace cura {
 
 void generateSupportGrid(SupportStorage& storage, OptimizedModel* om, int supportAngle, bool supportEverywhere, int supportXYDistance, int supportZDistance);
+//generateSupportGrid in steps, for faces that are streamed instead of held in an OptimizedModel. The grid covers modelMin up to modelMin + modelSize.
+void startSupportGrid(SupportStorage& storage, Point3 modelMin, Point3 modelSize, int supportAngle, bool supportEverywhere, int supportXYDistance, int supportZDistance);
+void addSupportFace(SupportStorage& storage, Point3 v0, Point3 v1, Point3 v2);
+void finishSupportGrid(SupportStorage& storage);
+void generateSupportRanges(SupportStorage& storage);
 
 class SupportPolyGenerator
 {
@@ -16,11 +21,9 @@ public:
 
 private:
     SupportStorage& storage;
-    double cosAngle;
     int32_t z;
-    int supportZDistance;
-    bool everywhere;
     int* done;
+    int fillNr;
 
     bool needSupportAt(Point p);
     void lazyFill(Point startPoint);
@@ -6,16 +6,66 @@
 
 #define MINIMUM_PLANNER_SPEED 0.05// (mm/sec)
 
-static double max_feedrate[TimeEstimateCalculator::NUM_AXIS] = {600, 600, 40, 25};
-static double minimumfeedrate = 0.01;
-static double acceleration = 3000;
-static double max_acceleration[TimeEstimateCalculator::NUM_AXIS] = {9000,9000,100,10000};
-static double max_xy_jerk = 20.0;
-static double max_z_jerk = 0.4;
-static double max_e_jerk = 5.0;
-
 template<typename T> const T square(const T& a) { return a * a; }
 
+void TimeEstimateCalculator::BlockList::resize(unsigned int n)
+{
+    accelerate_until.resize(n);
+    decelerate_after.resize(n);
+    initial_feedrate.resize(n);
+    final_feedrate.resize(n);
+    entry_speed.resize(n);
+    max_entry_speed.resize(n);
+    nominal_length_flag.resize(n);
+    nominal_feedrate.resize(n);
+    distance.resize(n);
+    acceleration.resize(n);
+}
+
+template<typename T> static void eraseFront(std::vector<T>& v, unsigned int n)
+{
+    v.erase(v.begin(), v.begin() + n);
+}
+
+void TimeEstimateCalculator::BlockList::removeFirst(unsigned int n)
+{
+    eraseFront(accelerate_until, n);
+    eraseFront(decelerate_after, n);
+    eraseFront(initial_feedrate, n);
+    eraseFront(final_feedrate, n);
+    eraseFront(entry_speed, n);
+    eraseFront(max_entry_speed, n);
+    eraseFront(nominal_length_flag, n);
+    eraseFront(nominal_feedrate, n);
+    eraseFront(distance, n);
+    eraseFront(acceleration, n);
+}
+
+void TimeEstimateCalculator::BlockList::clear()
+{
+    resize(0);
+}
+
+TimeEstimateCalculator::TimeEstimateCalculator()
+{
+    max_feedrate[X_AXIS] = 600;
+    max_feedrate[Y_AXIS] = 600;
+    max_feedrate[Z_AXIS] = 40;
+    max_feedrate[E_AXIS] = 25;
+    minimumfeedrate = 0.01;
+    acceleration = 3000;
+    max_acceleration[X_AXIS] = 9000;
+    max_acceleration[Y_AXIS] = 9000;
+    max_acceleration[Z_AXIS] = 100;
+    max_acceleration[E_AXIS] = 10000;
+    max_xy_jerk = 20.0;
+    max_z_jerk = 0.4;
+    max_e_jerk = 5.0;
+
+    previous_nominal_feedrate = 0.0;
+    segmentStart.push_back(0);
+}
+
 void TimeEstimateCalculator::applyAccelerationSettings(ConfigSettings& config)
 {
     acceleration = float(config.acceleration) / 1000.0;
@@ -34,6 +84,19 @@ void TimeEstimateCalculator::setPosition(Position newPos)
 void TimeEstimateCalculator::reset()
 {
     blocks.clear();
+    segmentStart.clear();
+    segmentStart.push_back(0);
+}
+
+void TimeEstimateCalculator::endSegment()
+{
+    if (blocks.size() > segmentStart.back())
+        segmentStart.push_back(blocks.size());
+}
+
+unsigned int TimeEstimateCalculator::getSegmentCount()
+{
+    return segmentStart.size() - 1;
 }
 
 // Calculates the maximum allowable speed at this point when you must be able to reach target_velocity using the 
@@ -70,62 +133,63 @@ static inline double acceleration_time_from_distance(double initial_feedrate, do
 }
 
 // Calculates trapezoid parameters so that the entry- and exit-speed is compensated by the provided factors.
-void TimeEstimateCalculator::calculate_trapezoid_for_block(Block *block, double entry_factor, double exit_factor)
+void TimeEstimateCalculator::calculate_trapezoid_for_block(unsigned int n, double entry_factor, double exit_factor)
 {
-    double initial_feedrate = block->nominal_feedrate*entry_factor;
-    double final_feedrate = block->nominal_feedrate*exit_factor;
+    double nominal_feedrate = blocks.nominal_feedrate[n];
+    double distance = blocks.distance[n];
+    double initial_feedrate = nominal_feedrate*entry_factor;
+    double final_feedrate = nominal_feedrate*exit_factor;
 
-    double acceleration = block->acceleration;
-    double accelerate_distance = estimate_acceleration_distance(initial_feedrate, block->nominal_feedrate, acceleration);
-    double decelerate_distance = estimate_acceleration_distance(block->nominal_feedrate, final_feedrate, -acceleration);
+    double acceleration = blocks.acceleration[n];
+    double accelerate_distance = estimate_acceleration_distance(initial_feedrate, nominal_feedrate, acceleration);
+    double decelerate_distance = estimate_acceleration_distance(nominal_feedrate, final_feedrate, -acceleration);
 
     // Calculate the size of Plateau of Nominal Rate.
-    double plateau_distance = block->distance-accelerate_distance - decelerate_distance;
+    double plateau_distance = distance-accelerate_distance - decelerate_distance;
 
     // Is the Plateau of Nominal Rate smaller than nothing? That means no cruising, and we will
     // have to use intersection_distance() to calculate when to abort acceleration and start braking
     // in order to reach the final_rate exactly at the end of this block.
     if (plateau_distance < 0)
     {
-        accelerate_distance = intersection_distance(initial_feedrate, final_feedrate, acceleration, block->distance);
+        accelerate_distance = intersection_distance(initial_feedrate, final_feedrate, acceleration, distance);
         accelerate_distance = std::max(accelerate_distance, 0.0); // Check limits due to numerical round-off
-        accelerate_distance = std::min(accelerate_distance, block->distance);//(We can cast here to unsigned, because the above line ensures that we are above zero)
+        accelerate_distance = std::min(accelerate_distance, distance);//(We can cast here to unsigned, because the above line ensures that we are above zero)
         plateau_distance = 0;
     }
 
-    block->accelerate_until = accelerate_distance;
-    block->decelerate_after = accelerate_distance+plateau_distance;
-    block->initial_feedrate = initial_feedrate;
-    block->final_feedrate = final_feedrate;
-}                    
+    blocks.accelerate_until[n] = accelerate_distance;
+    blocks.decelerate_after[n] = accelerate_distance+plateau_distance;
+    blocks.initial_feedrate[n] = initial_feedrate;
+    blocks.final_feedrate[n] = final_feedrate;
+}
 
 void TimeEstimateCalculator::plan(Position newPos, double feedrate)
 {
-    Block block;
-    memset(&block, 0, sizeof(block));
-    
-    block.maxTravel = 0;
+    Position delta;
+    Position absDelta;
+    double maxTravel = 0;
     for(unsigned int n=0; n<NUM_AXIS; n++)
     {
-        block.delta[n] = newPos[n] - currentPosition[n];
-        block.absDelta[n] = fabs(block.delta[n]);
-        block.maxTravel = std::max(block.maxTravel, block.absDelta[n]);
+        delta[n] = newPos[n] - currentPosition[n];
+        absDelta[n] = fabs(delta[n]);
+        maxTravel = std::max(maxTravel, absDelta[n]);
     }
-    if (block.maxTravel <= 0)
+    if (maxTravel <= 0)
         return;
     if (feedrate < minimumfeedrate)
         feedrate = minimumfeedrate;
-    block.distance = sqrtf(square(block.absDelta[0]) + square(block.absDelta[1]) + square(block.absDelta[2]));
-    if (block.distance == 0.0)
-        block.distance = block.absDelta[3];
-    block.nominal_feedrate = feedrate;
+    double distance = sqrtf(square(absDelta[0]) + square(absDelta[1]) + square(absDelta[2]));
+    if (distance == 0.0)
+        distance = absDelta[3];
+    double nominal_feedrate = feedrate;
     
     Position current_feedrate;
     Position current_abs_feedrate;
     double feedrate_factor = 1.0;
     for(unsigned int n=0; n<NUM_AXIS; n++)
     {
-        current_feedrate[n] = block.delta[n] * feedrate / block.distance;
+        current_feedrate[n] = delta[n] * feedrate / distance;
         current_abs_feedrate[n] = fabs(current_feedrate[n]);
         if (current_abs_feedrate[n] > max_feedrate[n])
             feedrate_factor = std::min(feedrate_factor, max_feedrate[n] / current_abs_feedrate[n]);
@@ -139,14 +203,14 @@ void TimeEstimateCalculator::plan(Position newPos, double feedrate)
             current_feedrate[n] *= feedrate_factor;
             current_abs_feedrate[n] *= feedrate_factor;
         }
-        block.nominal_feedrate *= feedrate_factor;
+        nominal_feedrate *= feedrate_factor;
     }
     
-    block.acceleration = acceleration;
+    double block_acceleration = acceleration;
     for(unsigned int n=0; n<NUM_AXIS; n++)
     {
-        if (block.acceleration * (block.absDelta[n] / block.distance) > max_acceleration[n])
-            block.acceleration = max_acceleration[n];
+        if (block_acceleration * (absDelta[n] / distance) > max_acceleration[n])
+            block_acceleration = max_acceleration[n];
     }
     
     double vmax_junction = max_xy_jerk/2; 
@@ -155,13 +219,14 @@ void TimeEstimateCalculator::plan(Position newPos, double feedrate)
         vmax_junction = std::min(vmax_junction, max_z_jerk/2);
     if(current_abs_feedrate[E_AXIS] > max_e_jerk/2)
         vmax_junction = std::min(vmax_junction, max_e_jerk/2);
-    vmax_junction = std::min(vmax_junction, block.nominal_feedrate);
+    vmax_junction = std::min(vmax_junction, nominal_feedrate);
     double safe_speed = vmax_junction;
     
-    if ((blocks.size() > 0) && (previous_nominal_feedrate > 0.0001))
+    //Junction speeds are only limited against the previous move of the same segment, so segments can be calculated independently.
+    if ((blocks.size() > segmentStart.back()) && (previous_nominal_feedrate > 0.0001))
     {
         double xy_jerk = sqrt(square(current_feedrate[X_AXIS]-previous_feedrate[X_AXIS])+square(current_feedrate[Y_AXIS]-previous_feedrate[Y_AXIS]));
-        vmax_junction = block.nominal_feedrate;
+        vmax_junction = nominal_feedrate;
         if (xy_jerk > max_xy_jerk) {
             vmax_junction_factor = (max_xy_jerk/xy_jerk);
         } 
@@ -174,144 +239,126 @@ void TimeEstimateCalculator::plan(Position newPos, double feedrate)
         vmax_junction = std::min(previous_nominal_feedrate, vmax_junction * vmax_junction_factor); // Limit speed to max previous speed
     }
     
-    block.max_entry_speed = vmax_junction;
+    double v_allowable = max_allowable_speed(-block_acceleration, MINIMUM_PLANNER_SPEED, distance);
 
-    double v_allowable = max_allowable_speed(-block.acceleration, MINIMUM_PLANNER_SPEED, block.distance);
-    block.entry_speed = std::min(vmax_junction, v_allowable);
-    block.nominal_length_flag = block.nominal_feedrate <= v_allowable;
-    block.recalculate_flag = true; // Always calculate trapezoid for new block
+    unsigned int n = blocks.size();
+    blocks.resize(n + 1);
+    blocks.nominal_feedrate[n] = nominal_feedrate;
+    blocks.distance[n] = distance;
+    blocks.acceleration[n] = block_acceleration;
+    blocks.max_entry_speed[n] = vmax_junction;
+    blocks.entry_speed[n] = std::min(vmax_junction, v_allowable);
+    blocks.nominal_length_flag[n] = nominal_feedrate <= v_allowable;
 
     previous_feedrate = current_feedrate;
-    previous_nominal_feedrate = block.nominal_feedrate;
+    previous_nominal_feedrate = nominal_feedrate;
 
     currentPosition = newPos;
 
-    calculate_trapezoid_for_block(&block, block.entry_speed/block.nominal_feedrate, safe_speed/block.nominal_feedrate);
-    
-    blocks.push_back(block);
+    calculate_trapezoid_for_block(n, blocks.entry_speed[n]/nominal_feedrate, safe_speed/nominal_feedrate);
+}
+
+void TimeEstimateCalculator::calculate(std::vector<double>& segmentTimes)
+{
+    int segmentCount = getSegmentCount();
+    segmentTimes.resize(segmentCount);
+    #pragma omp parallel for schedule(dynamic)
+    for(int n=0; n<segmentCount; n++)
+        segmentTimes[n] = calculateSegment(segmentStart[n], segmentStart[n + 1]);
+
+    //Keep the blocks of the segment that is still being planned.
+    blocks.removeFirst(segmentStart.back());
+    segmentStart.clear();
+    segmentStart.push_back(0);
 }
 
 double TimeEstimateCalculator::calculate()
 {
-    reverse_pass();
-    forward_pass();
-    recalculate_trapezoids();
+    endSegment();
+    std::vector<double> segmentTimes;
+    calculate(segmentTimes);
+    double totalTime = 0;
+    for(unsigned int n=0; n<segmentTimes.size(); n++)
+        totalTime += segmentTimes[n];
+    return totalTime;
+}
+
+double TimeEstimateCalculator::calculateSegment(unsigned int start, unsigned int end)
+{
+    reverse_pass(start, end);
+    forward_pass(start, end);
+    recalculate_trapezoids(start, end);
     
     double totalTime = 0;
-    for(unsigned int n=0; n<blocks.size(); n++)
+    for(unsigned int n=start; n<end; n++)
     {
-        double plateau_distance = blocks[n].decelerate_after - blocks[n].accelerate_until;
+        double plateau_distance = blocks.decelerate_after[n] - blocks.accelerate_until[n];
         
-        totalTime += acceleration_time_from_distance(blocks[n].initial_feedrate, blocks[n].accelerate_until, blocks[n].acceleration);
-        totalTime += plateau_distance / blocks[n].nominal_feedrate;
-        totalTime += acceleration_time_from_distance(blocks[n].final_feedrate, (blocks[n].distance - blocks[n].decelerate_after), blocks[n].acceleration);
+        totalTime += acceleration_time_from_distance(blocks.initial_feedrate[n], blocks.accelerate_until[n], blocks.acceleration[n]);
+        totalTime += plateau_distance / blocks.nominal_feedrate[n];
+        totalTime += acceleration_time_from_distance(blocks.final_feedrate[n], (blocks.distance[n] - blocks.decelerate_after[n]), blocks.acceleration[n]);
     }
     return totalTime;
 }
 
-// The kernel called by accelerationPlanner::calculate() when scanning the plan from last to first entry.
-void TimeEstimateCalculator::planner_reverse_pass_kernel(Block *previous, Block *current, Block *next)
+// The kernel called by calculateSegment() when scanning the plan from last to first entry.
+void TimeEstimateCalculator::planner_reverse_pass_kernel(unsigned int current, unsigned int next)
 {
-    (void)previous;
-    if(!current || !next)
-        return;
-
     // If entry speed is already at the maximum entry speed, no need to recheck. Block is cruising.
     // If not, block in state of acceleration or deceleration. Reset entry speed to maximum and
     // check for maximum allowable speed reductions to ensure maximum possible planned speed.
-    if (current->entry_speed != current->max_entry_speed)
+    if (blocks.entry_speed[current] != blocks.max_entry_speed[current])
     {
         // If nominal length true, max junction speed is guaranteed to be reached. Only compute
         // for max allowable speed if block is decelerating and nominal length is false.
-        if ((!current->nominal_length_flag) && (current->max_entry_speed > next->entry_speed))
+        if ((!blocks.nominal_length_flag[current]) && (blocks.max_entry_speed[current] > blocks.entry_speed[next]))
         {
-            current->entry_speed = std::min(current->max_entry_speed, max_allowable_speed(-current->acceleration, next->entry_speed, current->distance));
+            blocks.entry_speed[current] = std::min(blocks.max_entry_speed[current], max_allowable_speed(-blocks.acceleration[current], blocks.entry_speed[next], blocks.distance[current]));
         } else {
-            current->entry_speed = current->max_entry_speed;
+            blocks.entry_speed[current] = blocks.max_entry_speed[current];
         }
-        current->recalculate_flag = true;
     }
 }
 
-void TimeEstimateCalculator::reverse_pass()
+void TimeEstimateCalculator::reverse_pass(unsigned int start, unsigned int end)
 {
-    Block* block[3] = {nullptr, nullptr, nullptr};
-    for(unsigned int n=blocks.size()-1; int(n)>=0; n--)
-    {
-        block[2]= block[1];
-        block[1]= block[0];
-        block[0] = &blocks[n];
-        planner_reverse_pass_kernel(block[0], block[1], block[2]);
-    }
+    // Like Marlin, the first block of the plan is never changed by the reverse pass.
+    for(unsigned int n=end-1; n>start+1; n--)
+        planner_reverse_pass_kernel(n-1, n);
 }
 
-// The kernel called by accelerationPlanner::calculate() when scanning the plan from first to last entry.
-void TimeEstimateCalculator::planner_forward_pass_kernel(Block *previous, Block *current, Block *next)
+// The kernel called by calculateSegment() when scanning the plan from first to last entry.
+void TimeEstimateCalculator::planner_forward_pass_kernel(unsigned int previous, unsigned int current)
 {
-    (void)next;
-    if(!previous)
-        return;
-
     // If the previous block is an acceleration block, but it is not long enough to complete the
     // full speed change within the block, we need to adjust the entry speed accordingly. Entry
     // speeds have already been reset, maximized, and reverse planned by reverse planner.
     // If nominal length is true, max junction speed is guaranteed to be reached. No need to recheck.
-    if (!previous->nominal_length_flag)
+    if (!blocks.nominal_length_flag[previous])
     {
-        if (previous->entry_speed < current->entry_speed)
+        if (blocks.entry_speed[previous] < blocks.entry_speed[current])
         {
-            double entry_speed = std::min(current->entry_speed, max_allowable_speed(-previous->acceleration,previous->entry_speed,previous->distance) );
+            double entry_speed = std::min(blocks.entry_speed[current], max_allowable_speed(-blocks.acceleration[previous], blocks.entry_speed[previous], blocks.distance[previous]));
 
             // Check for junction speed change
-            if (current->entry_speed != entry_speed)
-            {
-                current->entry_speed = entry_speed;
-                current->recalculate_flag = true;
-            }
+            if (blocks.entry_speed[current] != entry_speed)
+                blocks.entry_speed[current] = entry_speed;
         }
     }
 }
 
-void TimeEstimateCalculator::forward_pass()
+void TimeEstimateCalculator::forward_pass(unsigned int start, unsigned int end)
 {
-    Block* block[3] = {nullptr, nullptr, nullptr};
-    for(unsigned int n=0; n<blocks.size(); n++)
-    {
-        block[0]= block[1];
-        block[1]= block[2];
-        block[2] = &blocks[n];
-        planner_forward_pass_kernel(block[0], block[1], block[2]);
-    }
-    planner_forward_pass_kernel(block[1], block[2], nullptr);
+    for(unsigned int n=start+1; n<end; n++)
+        planner_forward_pass_kernel(n-1, n);
 }
 
-// Recalculates the trapezoid speed profiles for all blocks in the plan according to the 
-// entry_factor for each junction. Must be called by planner_recalculate() after 
-// updating the blocks.
-void TimeEstimateCalculator::recalculate_trapezoids()
+// Recalculates the trapezoid speed profile according to the entry speed after the passes.
+// The estimator has always only recalculated the first block of a layer (the scan over the
+// junctions never got past the first block), the other blocks keep the trapezoid calculated
+// in plan(). This is kept as is, so print time estimates do not shift.
+void TimeEstimateCalculator::recalculate_trapezoids(unsigned int start, unsigned int end)
 {
-    Block *current;
-    Block *next = nullptr;
-
-    for(unsigned int n=0; n<blocks.size(); n--)
-    {
-        current = next;
-        next = &blocks[n];
-        if (current)
-        {
-            // Recalculate if current block entry or exit junction speed has changed.
-            if (current->recalculate_flag || next->recalculate_flag)
-            {
-                // NOTE: Entry and exit factors always > 0 by all previous logic operations.
-                calculate_trapezoid_for_block(current, current->entry_speed/current->nominal_feedrate, next->entry_speed/current->nominal_feedrate);
-                current->recalculate_flag = false; // Reset current only to ensure next trapezoid is computed
-            }
-        }
-    }
-    // Last/newest block in buffer. Exit speed is set with MINIMUM_PLANNER_SPEED. Always recalculated.
-    if(next != nullptr)
-    {
-        calculate_trapezoid_for_block(next, next->entry_speed/next->nominal_feedrate, MINIMUM_PLANNER_SPEED/next->nominal_feedrate);
-        next->recalculate_flag = false;
-    }
+    if (start < end)
+        calculate_trapezoid_for_block(start, blocks.entry_speed[start]/blocks.nominal_feedrate[start], MINIMUM_PLANNER_SPEED/blocks.nominal_feedrate[start]);
 }
@@ -29,51 +29,76 @@ public:
         double& operator[](const int n) { return axis[n]; }
     };
 
-    class Block
+    /**
+        The planned moves are stored as a structure of arrays, so the reverse/forward passes and the trapezoid
+        calculations walk contiguous memory. The blocks of several layers share one BlockList, each layer is a
+        segment [segmentStart[n], segmentStart[n+1]) which is planned independently of the other segments.
+    */
+    class BlockList
     {
     public:
-        bool recalculate_flag;
-        
-        double accelerate_until;
-        double decelerate_after;
-        double initial_feedrate;
-        double final_feedrate;
-
-        double entry_speed;
-        double max_entry_speed;
-        bool nominal_length_flag;
-        
-        double nominal_feedrate;
-        double maxTravel;
-        double distance;
-        double acceleration;
-        Position delta;
-        Position absDelta;
+        std::vector<double> accelerate_until;
+        std::vector<double> decelerate_after;
+        std::vector<double> initial_feedrate;
+        std::vector<double> final_feedrate;
+
+        std::vector<double> entry_speed;
+        std::vector<double> max_entry_speed;
+        std::vector<char> nominal_length_flag;
+
+        std::vector<double> nominal_feedrate;
+        std::vector<double> distance;
+        std::vector<double> acceleration;
+
+        unsigned int size() const { return distance.size(); }
+        void resize(unsigned int n);
+        void removeFirst(unsigned int n);
+        void clear();
     };
 
 private:
+    double max_feedrate[NUM_AXIS];
+    double minimumfeedrate;
+    double acceleration;
+    double max_acceleration[NUM_AXIS];
+    double max_xy_jerk;
+    double max_z_jerk;
+    double max_e_jerk;
+
     Position previous_feedrate;
     double previous_nominal_feedrate;
 
     Position currentPosition;
 
-    std::vector<Block> blocks;
+    BlockList blocks;
+    std::vector<unsigned int> segmentStart;
 public:
+    TimeEstimateCalculator();
+
     void applyAccelerationSettings(ConfigSettings& config);
 
     void setPosition(Position newPos);
     void plan(Position newPos, double feedRate);
     void reset();
-    
+
+    //Close the current segment (normally a layer), the following moves are planned as a new segment.
+    void endSegment();
+    unsigned int getSegmentCount();
+
+    //Calculate the time of all closed segments. Segments are calculated in parallel, the returned times are in planning order.
+    // The blocks of the calculated segments are released, the segment that is still open is kept.
+    void calculate(std::vector<double>& segmentTimes);
+    //Close the current segment and return the total time of all segments.
     double calculate();
 private:
-    void reverse_pass();
-    void forward_pass();
-    void recalculate_trapezoids();
-    
-    void calculate_trapezoid_for_block(Block *block, double entry_factor, double exit_factor);
-    void planner_reverse_pass_kernel(Block *previous, Block *current, Block *next);
-    void planner_forward_pass_kernel(Block *previous, Block *current, Block *next);
+    double calculateSegment(unsigned int start, unsigned int end);
+    void reverse_pass(unsigned int start, unsigned int end);
+    void forward_pass(unsigned int start, unsigned int end);
+    void recalculate_trapezoids(unsigned int start, unsigned int end);
+
+    void calculate_trapezoid_for_block(unsigned int n, double entry_factor, double exit_factor);
+    void planner_reverse_pass_kernel(unsigned int current, unsigned int next);
+    void planner_forward_pass_kernel(unsigned int previous, unsigned int current);
 };
 
 #endif//TIME_ESTIMATE_H
@@ -0,0 +1,81 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#ifdef HAVE_ZLIB
+#include <string.h>
+#include <algorithm>
+#include <zlib.h>
+
+#include "gzipStream.h"
+#include "logoutput.h"
+
+using namespace cura;
+
+GzipStream::GzipStream(FILE* f, int level)
+: f(f), level(level)
+{
+    buffer.reserve(GZIP_STREAM_BLOCK_SIZE * GZIP_STREAM_BLOCK_COUNT);
+}
+
+GzipStream::~GzipStream()
+{
+    flush();
+}
+
+void GzipStream::write(const char* data, size_t length)
+{
+    buffer.insert(buffer.end(), data, data + length);
+    if (buffer.size() >= GZIP_STREAM_BLOCK_SIZE * GZIP_STREAM_BLOCK_COUNT)
+        compressBlocks(false);
+}
+
+void GzipStream::flush()
+{
+    compressBlocks(true);
+    fflush(f);
+}
+
+static bool compressBlock(const char* data, size_t length, int level, std::vector<unsigned char>& result)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    //15 window bits + 16 writes a gzip header and trailer instead of a zlib wrapper.
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    result.resize(deflateBound(&stream, length) + 32);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = length;
+    stream.next_out = result.data();
+    stream.avail_out = result.size();
+    int ret = deflate(&stream, Z_FINISH);
+    result.resize(result.size() - stream.avail_out);
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+
+//Compress the full blocks in the buffer, or all the data when final is set. Whatever is not compressed stays in the buffer.
+void GzipStream::compressBlocks(bool final)
+{
+    int blockCount = buffer.size() / GZIP_STREAM_BLOCK_SIZE;
+    if (final && buffer.size() % GZIP_STREAM_BLOCK_SIZE)
+        blockCount++;
+    if (blockCount < 1)
+        return;
+
+    std::vector<std::vector<unsigned char> > results(blockCount);
+    std::vector<char> ok(blockCount);
+    #pragma omp parallel for schedule(dynamic)
+    for(int n=0; n<blockCount; n++)
+    {
+        size_t start = size_t(n) * GZIP_STREAM_BLOCK_SIZE;
+        size_t length = std::min(buffer.size() - start, size_t(GZIP_STREAM_BLOCK_SIZE));
+        ok[n] = compressBlock(buffer.data() + start, length, level, results[n]);
+    }
+    for(int n=0; n<blockCount; n++)
+    {
+        if (!ok[n])
+            cLogError("G-code compression failed\n");
+        fwrite(results[n].data(), 1, results[n].size(), f);
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + std::min(buffer.size(), size_t(blockCount) * GZIP_STREAM_BLOCK_SIZE));
+}
+
+#endif//HAVE_ZLIB
@@ -0,0 +1,35 @@
+/** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#ifndef GZIP_STREAM_H
+#define GZIP_STREAM_H
+
+#include <stdio.h>
+#include <vector>
+
+//Size of the blocks that are compressed independently, and the number of blocks collected before they are compressed in parallel.
+#define GZIP_STREAM_BLOCK_SIZE (1024 * 1024)
+#define GZIP_STREAM_BLOCK_COUNT 8
+
+/**
+    The GzipStream compresses the written data to a FILE as a gzip file.
+    The data is split into blocks which are compressed in parallel, every block is written as a separate gzip member.
+    Concatenated gzip members are a valid gzip file, which gunzip and zlib decompress as a single stream.
+    Only available when compiled with zlib (HAVE_ZLIB).
+*/
+class GzipStream
+{
+private:
+    FILE* f;
+    int level;
+    std::vector<char> buffer;
+
+    void compressBlocks(bool final);
+public:
+    GzipStream(FILE* f, int level = 6);
+    ~GzipStream();
+
+    void write(const char* data, size_t length);
+    //Compress and write everything that is buffered.
+    void flush();
+};
+
+#endif//GZIP_STREAM_H
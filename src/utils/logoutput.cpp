@@ -8,6 +8,8 @@ namespace cura {
 
 static int verbose_level;
 static bool progressLogging;
+static thread_local ProgressCallback progressCallback;
+static thread_local void* progressCallbackData;
 
 void increaseVerboseLevel()
 {
@@ -19,6 +21,12 @@ void enableProgressLogging()
     progressLogging = true;
 }
 
+void setProgressCallback(ProgressCallback callback, void* data)
+{
+    progressCallback = callback;
+    progressCallbackData = data;
+}
+
 
 #ifndef USE_G3LOG
 
@@ -45,6 +53,8 @@ void cLog(const char* fmt, ...)
 
 void cLogProgress(const char* type, int value, int maxValue)
 {
+    if (progressCallback)
+        progressCallback(progressCallbackData, type, value, maxValue);
     if (!progressLogging)
         return;
 
@@ -26,6 +26,10 @@ namespace cura {
 void increaseVerboseLevel();
 void enableProgressLogging();
 
+//Progress reports of the current thread are also passed to this callback, used to forward progress to a connected client.
+typedef void (*ProgressCallback)(void* data, const char* type, int value, int maxValue);
+void setProgressCallback(ProgressCallback callback, void* data);
+
 #ifndef USE_G3LOG
 //Report an error message (always reported, independed of verbose level)
 void cLogError(const char* fmt, ...);
@@ -21,6 +21,13 @@ namespace cura {
 const static int clipper_init = (0);
 #define NO_INDEX (std::numeric_limits<unsigned int>::max())
 
+#define HASH_SEED 14695981039346656037ULL
+//Mix a value into a hash, in the same 64bit FNV-1a way as Polygons::hash.
+static inline uint64_t hashCombine(uint64_t hash, uint64_t value)
+{
+    return (hash ^ value) * 1099511628211ULL;
+}
+
 class PolygonRef
 {
     ClipperLib::Path* polygon;
@@ -43,6 +50,8 @@ public:
         return (*polygon)[index];
     }
 
+    bool operator==(const PolygonRef& other) const { return *polygon == *other.polygon; }
+
     void* data()
     {
         return polygon->data();
@@ -64,6 +73,11 @@ public:
         polygon->clear();
     }
 
+    void resize(unsigned int newSize)
+    {
+        polygon->resize(newSize);
+    }
+
     bool orientation() const
     {
         return ClipperLib::Orientation(*polygon);
@@ -218,6 +232,20 @@ public:
         POLY_ASSERT(index < size());
         polygons.erase(polygons.begin() + index);
     }
+    //Remove all polygons with less then minimalPointCount points in a single pass.
+    void removeSmallPolygons(unsigned int minimalPointCount)
+    {
+        unsigned int keep = 0;
+        for(unsigned int n=0; n<polygons.size(); n++)
+        {
+            if (polygons[n].size() < minimalPointCount)
+                continue;
+            if (keep != n)
+                polygons[keep].swap(polygons[n]);
+            keep++;
+        }
+        polygons.resize(keep);
+    }
     void clear()
     {
         polygons.clear();
@@ -240,6 +268,24 @@ public:
     Polygons() {}
     Polygons(const Polygons& other) { polygons = other.polygons; }
     Polygons& operator=(const Polygons& other) { polygons = other.polygons; return *this; }
+    bool operator==(const Polygons& other) const { return polygons == other.polygons; }
+    bool operator!=(const Polygons& other) const { return polygons != other.polygons; }
+
+    //64bit FNV-1a hash of all the points, used to quickly find identical polygons.
+    uint64_t hash() const
+    {
+        uint64_t h = HASH_SEED;
+        for(unsigned int i=0; i<polygons.size(); i++)
+        {
+            h = hashCombine(h, polygons[i].size());
+            for(unsigned int j=0; j<polygons[i].size(); j++)
+            {
+                h = hashCombine(h, polygons[i][j].X);
+                h = hashCombine(h, polygons[i][j].Y);
+            }
+        }
+        return h;
+    }
     Polygons difference(const Polygons& other) const
     {
         Polygons ret;
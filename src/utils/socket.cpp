@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <chrono>
 
 #ifdef __WIN32
 #include <winsock2.h>
@@ -18,11 +20,35 @@
 bool wsaStartupDone = false;
 #endif
 
+//Sending to a client that went away has to fail the send instead of raising SIGPIPE, which would stop the whole server.
+#ifdef MSG_NOSIGNAL
+#define SOCKET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SOCKET_SEND_FLAGS 0
+#endif
+
 using namespace cura;
 
+//Platforms without MSG_NOSIGNAL (Mac OS X) disable SIGPIPE on the socket itself.
+static void disableSigPipe(int sockfd)
+{
+#ifdef SO_NOSIGPIPE
+    int noSigPipe = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#else
+    (void)sockfd;
+#endif
+}
+
 ClientSocket::ClientSocket()
 {
     sockfd = -1;
+    async = false;
+    sendFailed = false;
+    queuedBytes = 0;
+    maxQueuedBytes = 0;
+    sending = false;
+    stopSending = false;
 
 #ifdef __WIN32
     if (!wsaStartupDone)
@@ -40,6 +66,7 @@ void ClientSocket::connectTo(std::string host, int port)
 {
     struct sockaddr_in serv_addr;
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    disableSigPipe(sockfd);
     
     memset(&serv_addr, '0', sizeof(serv_addr)); 
     serv_addr.sin_family = AF_INET;
@@ -54,6 +81,18 @@ void ClientSocket::connectTo(std::string host, int port)
     }
 }
 
+void ClientSocket::attach(int sockfd)
+{
+    close();
+    this->sockfd = sockfd;
+    disableSigPipe(sockfd);
+}
+
+bool ClientSocket::isConnected()
+{
+    return sockfd != -1 && !sendFailed;
+}
+
 ClientSocket::~ClientSocket()
 {
     close();
@@ -66,19 +105,97 @@ void ClientSocket::sendNr(int nr)
 
 void ClientSocket::sendAll(const void* data, int length)
 {
-    if (sockfd == -1)
+    if (sockfd == -1 || sendFailed)
         return;
-    const char* ptr = static_cast<const char*>(data);
+    if (async)
+    {
+        const char* ptr = static_cast<const char*>(data);
+        sendBuffer.insert(sendBuffer.end(), ptr, ptr + length);
+        if (sendBuffer.size() >= SOCKET_SEND_BUFFER_SIZE)
+            flush();
+        return;
+    }
+    if (!sendDirect(static_cast<const char*>(data), length))
+        close();
+}
+
+bool ClientSocket::sendDirect(const char* ptr, int length)
+{
     while(length > 0)
     {
-        int n = send(sockfd, ptr, length, 0);
+        int n = send(sockfd, ptr, length, SOCKET_SEND_FLAGS);
         if (n <= 0)
-        {
-            close();
+            return false;
+        ptr += n;
+        length -= n;
+    }
+    return true;
+}
+
+void ClientSocket::enableAsyncSend(unsigned int maxQueuedBytes)
+{
+    if (async || sockfd == -1)
+        return;
+    this->maxQueuedBytes = maxQueuedBytes;
+    async = true;
+    stopSending = false;
+    sendThread = std::thread(&ClientSocket::sendThreadMain, this);
+}
+
+void ClientSocket::flush()
+{
+    if (!async || sendBuffer.empty())
+        return;
+    std::unique_lock<std::mutex> lock(sendMutex);
+    //Backpressure: wait till the background thread has room for more data.
+    sendChanged.wait(lock, [this]() { return sendFailed || queuedBytes < maxQueuedBytes; });
+    if (sendFailed)
+    {
+        sendBuffer.clear();
+        return;
+    }
+    queuedBytes += sendBuffer.size();
+    sendQueue.push_back(std::vector<char>());
+    sendQueue.back().swap(sendBuffer);
+    sendChanged.notify_all();
+}
+
+void ClientSocket::waitForSendQueue()
+{
+    if (!async)
+        return;
+    flush();
+    std::unique_lock<std::mutex> lock(sendMutex);
+    sendChanged.wait(lock, [this]() { return sendFailed || (sendQueue.empty() && !sending); });
+}
+
+void ClientSocket::sendThreadMain()
+{
+    std::unique_lock<std::mutex> lock(sendMutex);
+    while(true)
+    {
+        sendChanged.wait(lock, [this]() { return stopSending || !sendQueue.empty(); });
+        if (sendQueue.empty())
             return;
+        std::vector<char> data;
+        data.swap(sendQueue.front());
+        sendQueue.pop_front();
+        sending = true;
+        lock.unlock();
+
+        bool ok = sendDirect(data.data(), data.size());
+
+        lock.lock();
+        sending = false;
+        queuedBytes -= data.size();
+        if (!ok)
+        {
+            //The socket is closed by the owning thread, the remaining data is dropped.
+            sendFailed = true;
+            sendQueue.clear();
+            queuedBytes = 0;
         }
-        ptr += length;
-        length -= n;
+        sendChanged.notify_all();
     }
 }
 
@@ -93,6 +210,12 @@ void ClientSocket::recvAll(void* data, int length)
 {
     if (sockfd == -1)
         return;
+    waitForSendQueue();
+    if (sendFailed)
+    {
+        close();
+        return;
+    }
     char* ptr = static_cast<char*>(data);
     while(length > 0)
     {
@@ -109,6 +232,134 @@ void ClientSocket::recvAll(void* data, int length)
 }
 
 void ClientSocket::close()
+{
+    if (async)
+    {
+        //Send what is still buffered before the connection is closed.
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            stopSending = true;
+        }
+        sendChanged.notify_all();
+        sendThread.join();
+        async = false;
+    }
+    sendFailed = false;
+    if (sockfd == -1)
+        return;
+#ifdef __WIN32
+    closesocket(sockfd);
+#else
+    ::close(sockfd);
+#endif
+    sockfd = -1;
+}
+
+ServerSocket::ServerSocket()
+{
+    sockfd = -1;
+    stopped = false;
+
+#ifdef __WIN32
+    if (!wsaStartupDone)
+    {
+        WSADATA wsaData;
+        memset(&wsaData, 0, sizeof(WSADATA));
+        WSAStartup(MAKEWORD(1, 1), &wsaData);
+        wsaStartupDone = true;
+    }
+#endif
+}
+
+ServerSocket::~ServerSocket()
+{
+    close();
+}
+
+bool ServerSocket::listenOn(int port)
+{
+    struct sockaddr_in serv_addr;
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd == -1)
+        return false;
+
+    int reuse = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    //Only accept connections from the local machine, the protocol has no authentication.
+    serv_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (bind(sockfd, reinterpret_cast<struct sockaddr*>(&serv_addr), sizeof(serv_addr)) < 0 || listen(sockfd, 4) < 0)
+    {
+        cLogError("Listen on port %d failed\n", port);
+        close();
+        return false;
+    }
+    return true;
+}
+
+static int socketError()
+{
+#ifdef __WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+//Errors of accept that only fail a single connection, or last until some connections are closed. The server keeps listening after those.
+static bool isTransientAcceptError(int error)
+{
+#ifdef __WIN32
+    return error == WSAEINTR || error == WSAECONNRESET || error == WSAEMFILE || error == WSAENOBUFS || error == WSAEWOULDBLOCK;
+#else
+    return error == EINTR || error == ECONNABORTED || error == EPROTO || error == EAGAIN || error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM;
+#endif
+}
+
+bool ServerSocket::acceptClient(ClientSocket& client)
+{
+    bool retrying = false;
+    while(sockfd != -1 && !stopped)
+    {
+        int clientfd = accept(sockfd, nullptr, nullptr);
+        if (clientfd >= 0)
+        {
+            client.attach(clientfd);
+            return true;
+        }
+        int error = socketError();
+        if (stopped)
+            break;
+        if (!isTransientAcceptError(error))
+        {
+            cLogError("Failed to accept a connection: %s\n", strerror(error));
+            break;
+        }
+#ifndef __WIN32
+        if (error == EINTR)
+            continue;
+#endif
+        //Wait a little for running jobs to release descriptors or memory, instead of spinning on accept.
+        if (!retrying)
+            cLogError("Failed to accept a connection, retrying: %s\n", strerror(error));
+        retrying = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+void ServerSocket::stopListening()
+{
+    stopped = true;
+    if (sockfd != -1)
+        ::shutdown(sockfd, 2);
+}
+
+void ServerSocket::close()
 {
     if (sockfd == -1)
         return;
@@ -2,15 +2,51 @@
 #define SOCKET_H
 
 #include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+//Data is collected in a buffer of this size before it is handed to the sending thread.
+#define SOCKET_SEND_BUFFER_SIZE (64 * 1024)
 
 class ClientSocket
 {
     int sockfd;
+
+    //Asynchronous sending, see enableAsyncSend.
+    bool async;
+    //Set by the send thread, read without the lock by the thread that sends and receives.
+    std::atomic<bool> sendFailed;
+    std::vector<char> sendBuffer;
+    std::deque<std::vector<char> > sendQueue;
+    unsigned int queuedBytes;
+    unsigned int maxQueuedBytes;
+    bool sending;
+    bool stopSending;
+    std::thread sendThread;
+    std::mutex sendMutex;
+    std::condition_variable sendChanged;
+
+    bool sendDirect(const char* data, int length);
+    void sendThreadMain();
+    void waitForSendQueue();
 public:
     ClientSocket();
     ~ClientSocket();
     
     void connectTo(std::string host, int port);
+    //Take over an already connected socket, used for connections accepted by a ServerSocket.
+    void attach(int sockfd);
+    bool isConnected();
+
+    //Buffer the sent data and send it from a background thread. When more than maxQueuedBytes are waiting,
+    // sending blocks till the background thread has caught up. Receiving first waits till everything is sent.
+    void enableAsyncSend(unsigned int maxQueuedBytes);
+    //Hand the buffered data to the background thread.
+    void flush();
     
     void sendNr(int nr);
     void sendAll(const void* data, int length);
@@ -20,4 +56,22 @@ public:
     void close();
 };
 
+//Listening socket on the local host, the accepted connections are handled by a ClientSocket.
+class ServerSocket
+{
+    int sockfd;
+    std::atomic<bool> stopped;
+public:
+    ServerSocket();
+    ~ServerSocket();
+
+    bool listenOn(int port);
+    //Wait for the next connection. Transient errors are retried, returns false when listening was stopped or the socket failed.
+    bool acceptClient(ClientSocket& client);
+    //Stop accepting connections, wakes up a thread waiting in acceptClient.
+    void stopListening();
+
+    void close();
+};
+
 #endif//SOCKET_H